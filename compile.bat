@@ -13,6 +13,10 @@ if not exist bin mkdir bin
 
 %CPP% -obin/prog.exe obj/main.o || goto exit_err
 
+%CPP% -c -g -oobj/check_logic.o source/check_logic.cpp @includes.rsp || goto exit_err
+
+%CPP% -obin/check_logic.exe obj/check_logic.o || goto exit_err
+
 @echo off
 goto exit_ok
 
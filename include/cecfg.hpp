@@ -3,12 +3,21 @@
 
 #include <cstdio>
 #include <cstdint>
+#include <cstdlib>
+#include <cerrno>
 #include <vector>
 #include <unordered_map>
 #include <string>
+#include <variant>
+#include <type_traits>
 
 // @todo add namespaces
 
+// lines look like "<type>: name = value", the type is one of s, i, f, d and may be
+// followed by [] for a comma separated array, as "i[]: sizes = 1, 2, 4".
+// values are parsed when the file is loaded, malformed or out of range numbers are syntax
+// errors (code 2). lines may be of any length
+
 namespace cecfg
 {
 	using String = std::string;
@@ -23,8 +32,14 @@ namespace cecfg
 			Double,
 			String
 		};
+		using Value = std::variant<
+			std::monostate,
+			int32_t, float, double, ::cecfg::String,
+			std::vector<int32_t>, std::vector<float>, std::vector<double>, std::vector<::cecfg::String>
+		>;
 		Type tp;
-		::cecfg::String data;
+		bool array;
+		Value value;
 	};
 	
 	struct Loader
@@ -47,25 +62,34 @@ namespace cecfg
 			return nullptr;
 		}
 		
-		bool getOption(String const &s, void *dest, Variable::Type type)
+		// T is one of the types of Variable::Value, dest is left alone unless the
+		// variable exists with exactly that type
+		template <typename T>
+		bool getOption(String const &s, T &dest) const
 		{
-			Variable *var = (*this)[s];
-			if (!var || var->tp != type)
+			Variable const *var = (*this)[s];
+			if (!var)
 				return false;
 			
-			const char *cstr = var->data.c_str();
-			
+			T const *value = std::get_if<T>(&var->value);
+			if (!value)
+				return false;
+			dest = *value;
+			return true;
+		}
+		
+		// the same for scalars picked by the type
+		bool getOption(String const &s, void *dest, Variable::Type type) const
+		{
 			if (type == Variable::String)
-				*reinterpret_cast<String *>(dest) = var->data;
+				return getOption(s, *reinterpret_cast<String *>(dest));
 			else if (type == Variable::Int32)
-				*reinterpret_cast<int32_t *>(dest) = std::atoi(cstr);
+				return getOption(s, *reinterpret_cast<int32_t *>(dest));
 			else if (type == Variable::Float)
-				*reinterpret_cast<float *>(dest) = (float)std::atof(cstr);
+				return getOption(s, *reinterpret_cast<float *>(dest));
 			else if (type == Variable::Double)
-				*reinterpret_cast<double *>(dest) = std::atof(cstr);
-			else return false;
-			
-			return true;
+				return getOption(s, *reinterpret_cast<double *>(dest));
+			return false;
 		}
 		
 		int fromFile(const char *filename)
@@ -74,67 +98,182 @@ namespace cecfg
 			if (!fish)
 				return 1;
 			
-			const auto isLetter = [](char ch) {
-				return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
-			};
-			const auto isWhitespace = [](char ch) {
-				return ch == ' ' || ch == '\t';
-			};
-			const auto isLineSep = [](char ch) {
-				return ch == '\n' || ch == '\r';
-			};
-			
 			int retcode = 0;
-			char *buf = new char[1024];
+			String line;
+			while (readLine(fish, line))
+			{
+				retcode = parseLine(line);
+				if (retcode != 0)
+					break;
+			}
+			
+			fclose(fish);
 			
-			while (fgets(buf, 1024, fish) != nullptr)
+			return retcode;
+		}
+		
+	protected:
+		static bool isLetter(char ch) {
+			return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+		}
+		static bool isDigit(char ch) {
+			return ch >= '0' && ch <= '9';
+		}
+		static bool isWhitespace(char ch) {
+			return ch == ' ' || ch == '\t';
+		}
+		static bool isLineSep(char ch) {
+			return ch == '\n' || ch == '\r';
+		}
+		
+		// whole line without the separator, false at the end of the file
+		static bool readLine(FILE *fish, String &line)
+		{
+			char buf[1024];
+			line.clear();
+			while (fgets(buf, sizeof(buf), fish) != nullptr)
 			{
-				retcode = 2; // syntax error code
-				
-				Variable::Type tp;
-				if (buf[0] == 's')
-					tp = Variable::String;
-				else if (buf[0] == 'i')
-					tp = Variable::Int32;
-				else if (buf[0] == 'f')
-					tp = Variable::Float;
-				else if (buf[0] == '#' || isWhitespace(buf[0]) || isLineSep(buf[0]))
-					continue;
-				else break;
-				
-				if (buf[1] != ':')
+				line += buf;
+				if (!line.empty() && line.back() == '\n')
 					break;
+			}
+			if (line.empty())
+				return false;
+			while (!line.empty() && isLineSep(line.back()))
+				line.pop_back();
+			return true;
+		}
+		
+		static String trim(const char *beg, const char *end)
+		{
+			while (beg != end && isWhitespace(*beg))
+				++beg;
+			while (end != beg && isWhitespace(end[-1]))
+				--end;
+			return String(beg, end - beg);
+		}
+		
+		// one value of the type, all of the text has to be taken
+		template <typename T>
+		static bool parseValue(String const &text, T &res)
+		{
+			if constexpr (std::is_same_v<T, String>)
+			{
+				res = text;
+				return true;
+			}
+			else
+			{
+				if (text.empty())
+					return false;
 				
-				char *namebeg = buf + 2;
-				while (isWhitespace(*namebeg))
-					++namebeg;
-				if (!isLetter(*namebeg))
-					break;
+				const char *cstr = text.c_str();
+				char *end;
+				errno = 0;
+				if constexpr (std::is_same_v<T, int32_t>)
+				{
+					// long may be wider than 32 bits
+					long value = std::strtol(cstr, &end, 10);
+					if (value < INT32_MIN || value > INT32_MAX)
+						return false;
+					res = (int32_t)value;
+				}
+				else if constexpr (std::is_same_v<T, float>)
+					res = std::strtof(cstr, &end);
+				else
+					res = std::strtod(cstr, &end);
+				return *end == '\0' && errno != ERANGE;
+			}
+		}
+		
+		template <typename T>
+		static bool parse(const char *beg, const char *end, bool array, Variable::Value &res)
+		{
+			if (!array)
+			{
+				T value;
+				if (!parseValue(trim(beg, end), value))
+					return false;
+				res = std::move(value);
+				return true;
+			}
+			
+			std::vector<T> values;
+			while (true)
+			{
+				const char *sep = beg;
+				while (sep != end && *sep != ',')
+					++sep;
 				
-				char *nameend = namebeg;
-				while (isLetter(*++nameend));
+				T value;
+				if (!parseValue(trim(beg, sep), value))
+					return false;
+				values.push_back(std::move(value));
 				
-				char *databeg = nameend;
-				while (isWhitespace(*++databeg));
-				if (*databeg != '=')
+				if (sep == end)
 					break;
-				++databeg;
-				
-				char *dataend = databeg;
-				while (*dataend && !isLineSep(*dataend))
-					++dataend;
-				
-				vars[String(namebeg, nameend - namebeg)] = {
-					.tp = tp,
-					.data = String(databeg, dataend - databeg),
-				};
-				retcode = 0;
+				beg = sep + 1;
 			}
+			res = std::move(values);
+			return true;
+		}
+		
+		int parseLine(String const &line)
+		{
+			const char *buf = line.c_str();
 			
-			delete[] buf;
-			fclose(fish);
+			Variable::Type tp;
+			if (buf[0] == 's')
+				tp = Variable::String;
+			else if (buf[0] == 'i')
+				tp = Variable::Int32;
+			else if (buf[0] == 'f')
+				tp = Variable::Float;
+			else if (buf[0] == 'd')
+				tp = Variable::Double;
+			else if (buf[0] == '#' || buf[0] == '\0' || isWhitespace(buf[0]))
+				return 0;
+			else return 2; // syntax error code
 			
-			return retcode;
+			const char *pos = buf + 1;
+			bool array = pos[0] == '[' && pos[1] == ']';
+			if (array)
+				pos += 2;
+			if (*pos != ':')
+				return 2;
+			
+			const char *namebeg = pos + 1;
+			while (isWhitespace(*namebeg))
+				++namebeg;
+			if (!isLetter(*namebeg))
+				return 2;
+			
+			const char *nameend = namebeg;
+			while (isLetter(*++nameend) || isDigit(*nameend) || *nameend == '_');
+			
+			const char *databeg = nameend;
+			while (isWhitespace(*databeg))
+				++databeg;
+			if (*databeg != '=')
+				return 2;
+			++databeg;
+			const char *dataend = buf + line.size();
+			
+			Variable var {.tp = tp, .array = array, .value = {}};
+			bool ok = false;
+			if (tp == Variable::String)
+				ok = parse<String>(databeg, dataend, array, var.value);
+			else if (tp == Variable::Int32)
+				ok = parse<int32_t>(databeg, dataend, array, var.value);
+			else if (tp == Variable::Float)
+				ok = parse<float>(databeg, dataend, array, var.value);
+			else
+				ok = parse<double>(databeg, dataend, array, var.value);
+			if (!ok)
+				return 2;
+			
+			vars[String(namebeg, nameend - namebeg)] = std::move(var);
+			return 0;
 		}
 	};
 } // namespace cecfg
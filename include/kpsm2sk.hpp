@@ -3,11 +3,27 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <climits>
 #include <vector>
 #include <cassert>
 #include <iostream>
 #include <cmath>
 #include <random>
+#include <algorithm>
+#include <bitset>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define KPSM2SK_MMAP 1
+#endif
 
 namespace kpsm2sk
 {
@@ -35,10 +51,126 @@ namespace kpsm2sk
 	};
 	
 	struct Node
+	{
+		std::vector<Connection> links;
+	};
+	
+	// links of a whole layer kept as a formula: every node links to all nodes of the next
+	// layer (dense) or to its nodes [n + lo, n + hi) (banded), all with the same k, w, c or
+	// with a k, w, c per link in params. a node gets its own links only once something has
+	// to change them beyond that
+	struct LayerShape
+	{
+		enum Kind
+		{
+			Explicit = 0, // the links of the nodes
+			Dense,
+			Banded
+		};
+		Kind kind = Explicit;
+		Integer lo = 0;
+		Integer hi = 0;
+		float k = 0.f;
+		float w = 0.f;
+		float c = 0.f;
+		Integer width = 0;         // targets per row of params, next layer size or hi - lo
+		std::vector<float> params; // k, w, c of every target of every row, empty when uniform
+		std::vector<bool> own;     // nodes with materialized links
+		
+		inline bool implicit(Integer n) const {
+			return kind != Explicit && !(n < own.size() && own[n]);
+		}
+		inline bool dense(float k_, float w_, float c_) const {
+			return kind == Dense && params.empty() && k == k_ && w == w_ && c == c_;
+		}
+		
+		// index in params of the k of the link from node n to the target
+		inline std::size_t param(Integer n, Integer target) const {
+			return ((std::size_t)n * width + target - (kind == Dense ? 0 : n + lo)) * 3;
+		}
+		
+		// targets of node n in a next layer of the given size
+		inline Integer targetBeg(Integer n) const {
+			return kind == Dense ? 0 : std::max(n + lo, 0);
+		}
+		inline Integer targetEnd(Integer n, Integer next) const {
+			return kind == Dense ? next : std::clamp(n + hi, 0, next);
+		}
+	};
+	
+	struct Activation
 	{
 		float s; // signal
 		float c; // conductivity
-		std::vector<Connection> links;
+		uint32_t epoch; // the values are valid only while it matches the epoch of the layer
+	};
+	
+	class Network;
+	
+	// per-inference signals, kept apart from the topology so any number of threads
+	// can evaluate one network at once, each with its own state.
+	// resetting a layer only bumps its epoch, stale nodes read as reset ones
+	class ActivationState
+	{
+	public:
+		std::vector<std::vector<Activation>> layers;
+		std::vector<uint32_t> epochs;
+		
+		inline ActivationState() = default;
+		inline explicit ActivationState(Network const &net) {
+			fit(net);
+		}
+		
+		// follow the layer sizes of the network, new nodes start reset
+		inline void fit(Network const &net);
+		
+		// signal of a reset node, inputs are off until loaded
+		static inline float resetSignal(Integer layer) {
+			return layer == 0 ? 0.f : 1.f;
+		}
+		
+		inline float signal(NodeAddr i) const
+		{
+			Activation const &a = layers[i.layer][i.node];
+			return a.epoch == epochs[i.layer] ? a.s : resetSignal(i.layer);
+		}
+		inline float conductivity(NodeAddr i) const
+		{
+			Activation const &a = layers[i.layer][i.node];
+			return a.epoch == epochs[i.layer] ? a.c : 1.f;
+		}
+		
+		// get the node for update, resetting it first if stale
+		inline Activation &touch(NodeAddr i)
+		{
+			Activation &a = layers[i.layer][i.node];
+			if (a.epoch != epochs[i.layer])
+				a = {resetSignal(i.layer), 1.f, epochs[i.layer]};
+			return a;
+		}
+		
+		inline void setSignal(NodeAddr i, float s) {
+			touch(i).s = s;
+		}
+		
+		inline void reset(Integer nLayer)
+		{
+			if (++epochs[nLayer] != 0)
+				return;
+			// wrapped around, old stamps could become valid again
+			for (Activation &a: layers[nLayer])
+				a.epoch = 0;
+			epochs[nLayer] = 1;
+		}
+		// reset all but the input layer
+		inline void reset()
+		{
+			for (Integer i = 1; i < layers.size(); ++i)
+				reset(i);
+		}
+		inline void clearInput() {
+			reset(0);
+		}
 	};
 	
 	struct tuneResult
@@ -69,11 +201,344 @@ namespace kpsm2sk
 		std::vector<float> input;
 		std::vector<float> output;
 	};
+	
+	// samples laid out contiguously: row-major input and output matrices, or instead of the
+	// input matrix the indices of the inputs that are 1 (one-hot like inputs, the rest is 0)
+	struct TuneView
+	{
+		Integer rows;
+		Integer inputs;
+		Integer outputs;
+		float const *input;        // rows * inputs, null when sparse
+		float const *output;       // rows * outputs
+		uint32_t const *sparseBeg; // rows + 1 offsets into sparseIdx, null when dense
+		uint32_t const *sparseIdx;
+		
+		inline bool sparse() const {
+			return sparseBeg != nullptr;
+		}
+		inline float const *outputRow(Integer row) const {
+			return output + (std::size_t)row * outputs;
+		}
+		
+		// rows [beg, end) only
+		inline TuneView block(Integer beg, Integer end) const
+		{
+			TuneView res = *this;
+			res.rows = end - beg;
+			res.output = outputRow(beg);
+			if (sparse())
+				res.sparseBeg = sparseBeg + beg;
+			else
+				res.input = input + (std::size_t)beg * inputs;
+			return res;
+		}
+	};
+	
+	// owner of the samples of a TuneView, either in memory or mapped from a file
+	// (the file is read whole where mapping isn't available)
+	class TuneDataset
+	{
+	protected:
+		struct Header
+		{
+			char magic[8];
+			uint32_t sparse;
+			uint32_t reserved;
+			uint64_t rows;
+			uint64_t inputs;
+			uint64_t outputs;
+			uint64_t nonzero;
+		};
+		static constexpr char pMagic[8] = {'K', 'P', 'S', 'M', 'T', 'U', 'N', '1'};
+		
+		Integer pRows = 0, pInputs = 0, pOutputs = 0;
+		bool pSparse = false;
+		std::vector<float> pInput, pOutput;
+		std::vector<uint32_t> pSparseBeg {0}, pSparseIdx;
+		
+		// mapped file, the views point into it instead of the vectors
+		void *pMap = nullptr;
+		std::size_t pMapSize = 0;
+		TuneView pMapped {};
+		
+		// need += count * size, false when it doesn't fit a size_t
+		static inline bool grow(std::size_t &need, uint64_t count, std::size_t size)
+		{
+			if (count > (SIZE_MAX - need) / size)
+				return false;
+			need += count * size;
+			return true;
+		}
+		
+		inline void unmap()
+		{
+#ifdef KPSM2SK_MMAP
+			if (pMap)
+				munmap(pMap, pMapSize);
+#else
+			delete[] static_cast<char *>(pMap);
+#endif
+			pMap = nullptr;
+			pMapSize = 0;
+		}
+		
+	public:
+		inline TuneDataset() = default;
+		inline TuneDataset(Integer inputs, Integer outputs, bool sparse = false):
+			pInputs(inputs), pOutputs(outputs), pSparse(sparse)
+		{}
+		inline explicit TuneDataset(const std::vector<tuneSet> &tuneData, bool sparse = false)
+		{
+			if (tuneData.empty())
+				return;
+			pInputs = tuneData[0].input.size();
+			pOutputs = tuneData[0].output.size();
+			pSparse = sparse;
+			for (auto const &set: tuneData)
+			{
+				// all samples have the sizes of the first, others are left out
+				bool added = add(set);
+				assert(added);
+				(void)added;
+			}
+		}
+		
+		TuneDataset(TuneDataset const &) = delete;
+		TuneDataset &operator =(TuneDataset const &) = delete;
+		inline ~TuneDataset() {
+			unmap();
+		}
+		
+		// append a sample, a sparse dataset keeps the inputs equal to 1 (the rest must be 0)
+		inline void add(float const *input, float const *output)
+		{
+			assert(!pMap);
+			if (pSparse)
+			{
+				for (Integer i = 0; i != pInputs; ++i)
+				{
+					assert(input[i] == 0.f || input[i] == 1.f);
+					if (input[i] == 1.f)
+						pSparseIdx.push_back(i);
+				}
+				pSparseBeg.push_back(pSparseIdx.size());
+			}
+			else
+				pInput.insert(pInput.end(), input, input + pInputs);
+			pOutput.insert(pOutput.end(), output, output + pOutputs);
+			++pRows;
+		}
+		
+		// the same for a sample that may not fit, false (and nothing added) when its sizes differ
+		inline bool add(tuneSet const &set)
+		{
+			if (set.input.size() != (std::size_t)pInputs || set.output.size() != (std::size_t)pOutputs)
+				return false;
+			add(set.input.data(), set.output.data());
+			return true;
+		}
+		
+		inline TuneView view() const
+		{
+			if (pMap)
+				return pMapped;
+			return {
+				pRows, pInputs, pOutputs,
+				pSparse ? nullptr : pInput.data(),
+				pOutput.data(),
+				pSparse ? pSparseBeg.data() : nullptr,
+				pSparse ? pSparseIdx.data() : nullptr
+			};
+		}
+		
+		// file layout: header, outputs, then the inputs or the sparse offsets and indices
+		inline int save(const char *filename) const
+		{
+			TuneView v = view();
+			FILE *fish = std::fopen(filename, "wb");
+			if (!fish)
+				return 1;
+			
+			Header h {};
+			std::memcpy(h.magic, pMagic, sizeof(pMagic));
+			h.sparse = v.sparse();
+			h.rows = v.rows;
+			h.inputs = v.inputs;
+			h.outputs = v.outputs;
+			h.nonzero = v.sparse() ? v.sparseBeg[v.rows] : 0;
+			
+			bool ok = std::fwrite(&h, sizeof(h), 1, fish) == 1;
+			ok = ok && std::fwrite(v.output, sizeof(float), (std::size_t)v.rows * v.outputs, fish) == (std::size_t)v.rows * v.outputs;
+			if (v.sparse())
+			{
+				ok = ok && std::fwrite(v.sparseBeg, sizeof(uint32_t), v.rows + 1, fish) == v.rows + 1;
+				ok = ok && std::fwrite(v.sparseIdx, sizeof(uint32_t), h.nonzero, fish) == h.nonzero;
+			}
+			else
+				ok = ok && std::fwrite(v.input, sizeof(float), (std::size_t)v.rows * v.inputs, fish) == (std::size_t)v.rows * v.inputs;
+			
+			std::fclose(fish);
+			return ok ? 0 : 2;
+		}
+		
+		// map a saved dataset, the pages are read as the samples are visited
+		inline int open(const char *filename)
+		{
+			unmap();
+#ifdef KPSM2SK_MMAP
+			int fd = ::open(filename, O_RDONLY);
+			if (fd < 0)
+				return 1;
+			struct stat st;
+			if (fstat(fd, &st) != 0 || (std::size_t)st.st_size < sizeof(Header)) {
+				::close(fd);
+				return 2;
+			}
+			void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+			if (map == MAP_FAILED)
+				return 1;
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			pMap = map;
+			pMapSize = st.st_size;
+#else
+			FILE *fish = std::fopen(filename, "rb");
+			if (!fish)
+				return 1;
+			std::fseek(fish, 0, SEEK_END);
+			long size = std::ftell(fish);
+			std::fseek(fish, 0, SEEK_SET);
+			if (size < (long)sizeof(Header)) {
+				std::fclose(fish);
+				return 2;
+			}
+			pMap = new char[size];
+			pMapSize = size;
+			bool ok = std::fread(pMap, 1, size, fish) == (std::size_t)size;
+			std::fclose(fish);
+			if (!ok) {
+				unmap();
+				return 1;
+			}
+#endif
+			Header h;
+			std::memcpy(&h, pMap, sizeof(h));
+			char const *data = static_cast<char const *>(pMap) + sizeof(Header);
+			
+			// the sizes have to fit an Integer and the file, the sparse offsets have to run
+			// from 0 up to nonzero and the indices have to be inputs, so the views can be trusted
+			std::size_t need = sizeof(Header);
+			bool ok = std::memcmp(h.magic, pMagic, sizeof(pMagic)) == 0 && h.sparse <= 1
+				&& h.rows <= INT_MAX && h.inputs <= INT_MAX && h.outputs <= INT_MAX
+				&& grow(need, h.rows * h.outputs, sizeof(float));
+			if (h.sparse)
+				ok = ok && h.nonzero <= UINT32_MAX && grow(need, h.rows + 1, sizeof(uint32_t)) && grow(need, h.nonzero, sizeof(uint32_t));
+			else
+				ok = ok && grow(need, h.rows * h.inputs, sizeof(float));
+			ok = ok && need <= pMapSize;
+			
+			pMapped = {(Integer)h.rows, (Integer)h.inputs, (Integer)h.outputs, nullptr, nullptr, nullptr, nullptr};
+			if (ok)
+			{
+				pMapped.output = reinterpret_cast<float const *>(data);
+				data += h.rows * h.outputs * sizeof(float);
+				if (h.sparse)
+				{
+					pMapped.sparseBeg = reinterpret_cast<uint32_t const *>(data);
+					pMapped.sparseIdx = pMapped.sparseBeg + h.rows + 1;
+					ok = pMapped.sparseBeg[0] == 0 && pMapped.sparseBeg[h.rows] == h.nonzero;
+					for (uint64_t i = 0; ok && i != h.rows; ++i)
+						ok = pMapped.sparseBeg[i] <= pMapped.sparseBeg[i + 1];
+					for (uint64_t i = 0; ok && i != h.nonzero; ++i)
+						ok = pMapped.sparseIdx[i] < h.inputs;
+				}
+				else
+					pMapped.input = reinterpret_cast<float const *>(data);
+			}
+			if (!ok) {
+				unmap();
+				pMapped = {};
+				return 2;
+			}
+			return 0;
+		}
+	};
+	
+	// rough per-allocation bookkeeping of a general purpose heap (header + alignment)
+	constexpr std::size_t allocOverhead = 16;
+	
+	struct LayerMemory
+	{
+		std::size_t nodes;
+		std::size_t links;
+		std::size_t implicitLinks;  // of them held by the layer shape, without a Connection each
+		std::size_t nodeBytes;      // node array, as reserved
+		std::size_t linkBytes;      // links in use
+		std::size_t linkCapacity;   // links reserved by the vectors
+		std::size_t overhead;       // estimated allocator overhead
+		
+		inline std::size_t total() const {
+			return nodeBytes + linkCapacity + overhead;
+		}
+	};
+	
+	struct MemoryUsage
+	{
+		std::vector<LayerMemory> layers;
+		
+		inline std::size_t total() const
+		{
+			std::size_t n = 0;
+			for (auto const &layer: layers)
+				n += layer.total();
+			return n;
+		}
+		
+		inline void print(std::ostream &os) const
+		{
+			for (std::size_t i = 0; i != layers.size(); ++i)
+			{
+				auto const &l = layers[i];
+				os << "layer " << i << ": " << l.nodes << " nodes, " << l.links << " links";
+				if (l.implicitLinks != 0)
+					os << " (" << l.implicitLinks << " implicit)";
+				os << ", " << l.nodeBytes << " B nodes, " << l.linkBytes << " / " << l.linkCapacity << " B links used / reserved, ~"
+					<< l.overhead << " B allocator overhead\n";
+			}
+			os << "network total: " << total() << " B\n";
+		}
+	};
 
+	struct CompactReport
+	{
+		std::size_t links;              // links removed
+		std::vector<std::size_t> nodes; // dead nodes removed, per layer
+		
+		inline void print(std::ostream &os) const
+		{
+			os << "compacted: " << links << " links";
+			for (std::size_t i = 0; i != nodes.size(); ++i)
+				if (nodes[i] != 0)
+					os << ", " << nodes[i] << " nodes of layer " << i;
+			os << " removed\n";
+		}
+	};
+	
 	class Network
 	{
 	public:
 		std::vector<std::vector<Node>> mat;
+		std::vector<LayerShape> shapes; // per layer, the missing ones are explicit
+		ActivationState state; // used by the members without explicit state
+		
+		// how buildByConfig keeps the links of the layers it makes
+		enum class LinkStorage
+		{
+			Explicit, // a Connection per link
+			Shape,    // a LayerShape with one k, w, c, nodes get their links once tuned
+			Matrix    // a LayerShape with a k, w, c per link, tuned in place
+		};
 		
 		inline Network() = default;
 		
@@ -81,9 +546,10 @@ namespace kpsm2sk
 			std::vector<Integer> const &config,
 			float k = 0.25f,
 			float w = 0.5f,
-			float c = 0.0f
+			float c = 0.0f,
+			LinkStorage storage = LinkStorage::Explicit
 		) {
-			buildByConfig(config, k, w, c);
+			buildByConfig(config, k, w, c, storage);
 		}
 		
 		inline Network (
@@ -91,15 +557,16 @@ namespace kpsm2sk
 			std::vector<Integer> const &branching,
 			float k = 0.25f,
 			float w = 0.5f,
-			float c = 0.0f
+			float c = 0.0f,
+			LinkStorage storage = LinkStorage::Explicit
 		) {
-			buildByConfig(config, branching, k, w, c);
+			buildByConfig(config, branching, k, w, c, storage);
 		}
 		
-		inline Integer layers() {
+		inline Integer layers() const {
 			return mat.size();
 		}
-		inline Integer nodes()
+		inline Integer nodes() const
 		{
 			Integer n = 0;
 			for (auto const &layer: mat) {
@@ -108,6 +575,50 @@ namespace kpsm2sk
 			return n;
 		}
 		
+		inline MemoryUsage memoryUsage() const
+		{
+			MemoryUsage res;
+			res.layers.reserve(mat.size());
+			
+			for (Integer l = 0; l != mat.size(); ++l)
+			{
+				auto const &layer = mat[l];
+				LayerMemory lm {};
+				lm.nodes = layer.size();
+				lm.nodeBytes = layer.capacity() * sizeof(Node);
+				if (layer.capacity() != 0)
+					lm.overhead += allocOverhead;
+				if (l < shapes.size())
+				{
+					auto const &params = shapes[l].params;
+					lm.overhead += shapes[l].own.capacity() / 8;
+					lm.linkBytes += params.size() * sizeof(float);
+					lm.linkCapacity += params.capacity() * sizeof(float);
+					if (params.capacity() != 0)
+						lm.overhead += allocOverhead;
+				}
+				
+				for (Integer n = 0; n != layer.size(); ++n)
+				{
+					Node const &node = layer[n];
+					if (implicit({l, n}))
+					{
+						Integer count = linkCount({l, n});
+						lm.links += count;
+						lm.implicitLinks += count;
+						continue;
+					}
+					lm.links += node.links.size();
+					lm.linkBytes += node.links.size() * sizeof(Connection);
+					lm.linkCapacity += node.links.capacity() * sizeof(Connection);
+					if (node.links.capacity() != 0)
+						lm.overhead += allocOverhead;
+				}
+				res.layers.push_back(lm);
+			}
+			return res;
+		}
+		
 		enum class ConProperty
 		{
 			K = 1, // forward coefficient
@@ -115,20 +626,124 @@ namespace kpsm2sk
 			C = 3, // conductivity impact
 		};
 		
+		// the mutable ones give implicit nodes their own links, so they may be changed.
+		// the const ones show implicit nodes without links, link() and linkCount() read them
 		inline Node &operator [](NodeAddr i) {
-			return mat[i.layer][i.node];
+			return materialize(i);
 		}
 		inline Node const &operator [](NodeAddr i) const {
 			return mat[i.layer][i.node];
 		}
 		
 		inline std::vector<Node> &operator [](Integer i) {
+			materialize(i);
 			return mat[i];
 		}
 		inline std::vector<Node> const &operator [](Integer i) const {
 			return mat[i];
 		}
 		
+		inline bool implicit(NodeAddr i) const {
+			return i.layer < shapes.size() && shapes[i.layer].implicit(i.node);
+		}
+		inline bool hasImplicit() const
+		{
+			for (auto const &shape: shapes)
+				if (shape.kind != LayerShape::Explicit)
+					return true;
+			return false;
+		}
+		
+		inline Integer linkCount(NodeAddr i) const
+		{
+			if (!implicit(i))
+				return mat[i.layer][i.node].links.size();
+			LayerShape const &shape = shapes[i.layer];
+			return std::max(shape.targetEnd(i.node, mat[i.layer + 1].size()) - shape.targetBeg(i.node), 0);
+		}
+		inline Connection link(NodeAddr i, Integer n) const
+		{
+			if (!implicit(i))
+				return mat[i.layer][i.node].links[n];
+			LayerShape const &shape = shapes[i.layer];
+			const Integer target = shape.targetBeg(i.node) + n;
+			if (shape.params.empty())
+				return Connection {shape.k, shape.w, shape.c, NodeAddr {i.layer + 1, target}};
+			float const *p = &shape.params[shape.param(i.node, target)];
+			return Connection {p[0], p[1], p[2], NodeAddr {i.layer + 1, target}};
+		}
+		
+		// a k, w or c to change: in the parameter matrix of the layer when it has one,
+		// otherwise of the links of the node, which get materialized
+		inline float &param(LinkAddr i, ConProperty prop)
+		{
+			const Integer offset = prop == ConProperty::K ? 0 : prop == ConProperty::W ? 1 : 2;
+			if (implicit({i.layer, i.node}) && !shapes[i.layer].params.empty())
+			{
+				LayerShape &shape = shapes[i.layer];
+				return shape.params[shape.param(i.node, shape.targetBeg(i.node) + i.link) + offset];
+			}
+			Connection &lnk = materialize(NodeAddr {i.layer, i.node}).links[i.link];
+			return offset == 0 ? lnk.k : offset == 1 ? lnk.w : lnk.c;
+		}
+		
+		// give an implicit layer a k, w, c per link, starting from its uniform ones
+		inline void makeParamMatrix(Integer layer)
+		{
+			if (layer >= shapes.size() || shapes[layer].kind == LayerShape::Explicit || !shapes[layer].params.empty())
+				return;
+			LayerShape &shape = shapes[layer];
+			shape.width = shape.kind == LayerShape::Dense ? mat[layer + 1].size() : shape.hi - shape.lo;
+			shape.params.resize((std::size_t)mat[layer].size() * shape.width * 3);
+			for (std::size_t i = 0; i != shape.params.size(); i += 3)
+			{
+				shape.params[i] = shape.k;
+				shape.params[i + 1] = shape.w;
+				shape.params[i + 2] = shape.c;
+			}
+		}
+		
+		// give the node its own links, from then on they may differ from the shape
+		inline Node &materialize(NodeAddr i)
+		{
+			Node &node = mat[i.layer][i.node];
+			if (!implicit(i))
+				return node;
+			assert(node.links.empty());
+			
+			LayerShape &shape = shapes[i.layer];
+			Integer count = linkCount(i);
+			node.links.reserve(count);
+			for (Integer n = 0; n != count; ++n)
+				node.links.push_back(link(i, n));
+			
+			if (shape.own.size() < mat[i.layer].size())
+				shape.own.resize(mat[i.layer].size());
+			shape.own[i.node] = true;
+			return node;
+		}
+		// the same for a whole layer, which becomes explicit
+		inline void materialize(Integer layer)
+		{
+			if (layer >= shapes.size() || shapes[layer].kind == LayerShape::Explicit)
+				return;
+			for (Integer n = 0; n != mat[layer].size(); ++n)
+				materialize(NodeAddr {layer, n});
+			shapes[layer] = LayerShape();
+		}
+		inline void materialize()
+		{
+			for (Integer l = 0; l != shapes.size(); ++l)
+				materialize(l);
+			shapes.clear();
+		}
+		inline Network explicitCopy() const
+		{
+			Network res(*this);
+			res.materialize();
+			return res;
+		}
+		
 		inline void expandLayer (
 			Integer layer,
 			Integer numNodes,
@@ -141,16 +756,17 @@ namespace kpsm2sk
 				return;
 			assert(numNodes > prevNodes);
 			
-			mat[layer].resize(numNodes);
+			linkFromPrevious(layer, prevNodes, numNodes, k, w, c);
 			
-			// Update connections of previous layer
-			if (layer > 0)
-				for (Integer i = prevNodes; i != numNodes; ++i)
-					for (Node &node: mat[layer - 1])
-						node.links.push_back(Connection {k, w, c, NodeAddr {layer, i}});
+			// a dense layer with the same parameters links the new nodes by itself
+			bool covered = layer < shapes.size() && shapes[layer].dense(k, w, c);
+			if (!covered)
+				materialize(layer);
+			
+			mat[layer].resize(numNodes);
 			
 			// And this layer
-			if (layer + 1 < mat.size())
+			if (layer + 1 < mat.size() && !covered)
 				for (Integer i = prevNodes; i != numNodes; ++i)
 					for (Integer n = 0; n != mat[layer + 1].size(); ++n)
 						mat[layer][i].links.push_back(Connection {k, w, c, NodeAddr {layer + 1, n}});
@@ -166,6 +782,9 @@ namespace kpsm2sk
 			Integer prevNodes = mat[layer].size();
 			assert(numNodes >= prevNodes);
 			
+			// the previous layer links to the new one at the same places
+			linkFromPrevious(layer, prevNodes, numNodes, k, w, c);
+			
 			// Move addresses first
 			for (Integer i = layer; i < mat.size(); ++i)
 				for (Node &node: mat[i])
@@ -178,6 +797,8 @@ namespace kpsm2sk
 				mat[i] = std::move(mat[i - 1]);
 			
 			mat[layer] = std::vector<Node>(numNodes);
+			if (layer < shapes.size())
+				shapes.insert(shapes.begin() + layer, LayerShape());
 					
 			// Link all nodes from next layer
 			if (layer + 1 < mat.size())
@@ -192,22 +813,33 @@ namespace kpsm2sk
 								NodeAddr {layer + 1, i}
 							}
 						);
+		}
+		
+		// link every node of the layer before to the nodes [beg, end) of the layer, before
+		// it grows. a dense layer with the same parameters links them by itself
+		inline void linkFromPrevious(Integer layer, Integer beg, Integer end, float k, float w, float c)
+		{
+			if (layer == 0)
+				return;
+			if (layer - 1 >= shapes.size() || !shapes[layer - 1].dense(k, w, c))
+				materialize(layer - 1);
 			
-			// Update previous layer
-			if (layer > 0)
-				for (Integer i = prevNodes; i != numNodes; ++i)
-					for (Node &node: mat[layer - 1])
-						node.links.push_back(Connection {k, w, c, NodeAddr {layer, i}});
+			for (Integer i = beg; i != end; ++i)
+				for (Integer n = 0; n != mat[layer - 1].size(); ++n)
+					if (!implicit({layer - 1, n}))
+						mat[layer - 1][n].links.push_back(Connection {k, w, c, NodeAddr {layer, i}});
 		}
 		
 		inline void buildByConfig (
 			std::vector<Integer> const &config,
 			float k = 0.25f,
 			float w = 0.5f,
-			float c = 0.0f
+			float c = 0.0f,
+			LinkStorage storage = LinkStorage::Explicit
 		) {
 			const Integer layers = config.size();
 			mat = std::vector<std::vector<Node>>(layers);
+			shapes = std::vector<LayerShape>(layers);
 			
 			for (Integer nLayer = 0; nLayer != layers; ++nLayer)
 			{
@@ -215,15 +847,14 @@ namespace kpsm2sk
 				
 				if (nLayer + 1 == layers) break;
 				
-				for (Node &node: mat[nLayer])
-				{
-					// insert links to all nodes in next layer
-					for (Integer i = 0; i < config[nLayer + 1]; ++i)
-					{
-						node.links.push_back(Connection {k, w, c, NodeAddr {nLayer + 1, i}});
-					}
-				}
+				// links to all nodes in next layer
+				LayerShape &shape = shapes[nLayer];
+				shape.kind = LayerShape::Dense;
+				shape.k = k;
+				shape.w = w;
+				shape.c = c;
 			}
+			applyStorage(storage);
 		}
 		
 		inline void buildByConfig (
@@ -231,10 +862,12 @@ namespace kpsm2sk
 			std::vector<Integer> const &branching,
 			float k = 0.25f,
 			float w = 0.5f,
-			float c = 0.0f
+			float c = 0.0f,
+			LinkStorage storage = LinkStorage::Explicit
 		) {
 			const Integer layers = config.size();
 			mat = std::vector<std::vector<Node>>(layers);
+			shapes = std::vector<LayerShape>(layers);
 			
 			for (Integer nLayer = 0; nLayer != layers; ++nLayer)
 			{
@@ -242,23 +875,303 @@ namespace kpsm2sk
 				
 				if (nLayer + 1 == layers) break;
 				
-				for (Integer n = 0; n != mat[nLayer].size(); ++n)
+				// node n links to [n - branching, n + branching) of next layer
+				LayerShape &shape = shapes[nLayer];
+				shape.kind = LayerShape::Banded;
+				shape.lo = -branching[nLayer];
+				shape.hi = branching[nLayer];
+				shape.k = k;
+				shape.w = w;
+				shape.c = c;
+			}
+			applyStorage(storage);
+		}
+		
+		// the layers are built as shapes, turned into the storage asked for
+		inline void applyStorage(LinkStorage storage)
+		{
+			if (storage == LinkStorage::Explicit)
+				materialize();
+			else if (storage == LinkStorage::Matrix)
+				for (Integer l = 0; l != shapes.size(); ++l)
+					makeParamMatrix(l);
+		}
+		
+		// drop the marked nodes along with the links to them, renumber the rest
+		inline void removeNodes(std::vector<std::vector<bool>> const &drop)
+		{
+			materialize();
+			
+			std::vector<std::vector<Integer>> newIndex(mat.size());
+			for (Integer l = 0; l != mat.size(); ++l)
+			{
+				newIndex[l].resize(mat[l].size());
+				Integer next = 0;
+				for (Integer n = 0; n != mat[l].size(); ++n)
+					newIndex[l][n] = drop[l][n] ? -1 : next++;
+			}
+			
+			for (Integer l = 0; l != mat.size(); ++l)
+			{
+				Integer next = 0;
+				for (Integer n = 0; n != mat[l].size(); ++n)
 				{
-					Node &node = mat[nLayer][n];
+					if (drop[l][n])
+						continue;
 					
-					Integer i = n - branching[nLayer];
-					if (i < 0) i = 0;
+					auto &links = mat[l][n].links;
+					Integer keep = 0;
+					for (auto const &lnk: links)
+					{
+						Integer target = newIndex[lnk.addr.layer][lnk.addr.node];
+						if (target < 0)
+							continue;
+						links[keep] = lnk;
+						links[keep++].addr.node = target;
+					}
+					links.resize(keep);
 					
-					Integer end = n + branching[nLayer];
-					if (end > config[nLayer + 1])
-						end = config[nLayer + 1];
+					if (next != n)
+						mat[l][next] = std::move(mat[l][n]);
+					++next;
+				}
+				mat[l].resize(next);
+			}
+		}
+		
+		// copy of the marked nodes and the links between them, renumbered
+		inline Network extract(std::vector<std::vector<bool>> const &keep) const
+		{
+			if (hasImplicit())
+				return explicitCopy().extract(keep);
+			
+			std::vector<std::vector<Integer>> newIndex(mat.size());
+			Network res;
+			res.mat.resize(mat.size());
+			
+			for (Integer l = 0; l != mat.size(); ++l)
+			{
+				newIndex[l].resize(mat[l].size());
+				Integer next = 0;
+				for (Integer n = 0; n != mat[l].size(); ++n)
+					newIndex[l][n] = keep[l][n] ? next++ : -1;
+				res.mat[l].resize(next);
+			}
+			
+			for (Integer l = 0; l != mat.size(); ++l)
+			{
+				for (Integer n = 0; n != mat[l].size(); ++n)
+				{
+					if (!keep[l][n])
+						continue;
+					
+					auto &links = res.mat[l][newIndex[l][n]].links;
+					for (auto const &lnk: mat[l][n].links)
+					{
+						Integer target = newIndex[lnk.addr.layer][lnk.addr.node];
+						if (target < 0)
+							continue;
+						links.push_back(lnk);
+						links.back().addr.node = target;
+					}
+					links.shrink_to_fit();
+				}
+			}
+			return res;
+		}
+		
+		// the part of the network computing outputs [beg, end), which become outputs [0, end - beg).
+		// all inputs are kept so the input layout stays the same
+		inline Network extractOutputs(Integer beg, Integer end) const
+		{
+			if (hasImplicit())
+				return explicitCopy().extractOutputs(beg, end);
+			
+			std::vector<std::vector<bool>> keep(mat.size());
+			for (Integer l = 0; l != mat.size(); ++l)
+				keep[l].resize(mat[l].size(), l == 0);
+			for (Integer n = beg; n != end; ++n)
+				keep.back()[n] = true;
+			
+			for (Integer l = (Integer)mat.size() - 2; l > 0; --l)
+				for (Integer n = 0; n != mat[l].size(); ++n)
+					for (auto const &lnk: mat[l][n].links)
+						if (keep[lnk.addr.layer][lnk.addr.node]) {
+							keep[l][n] = true;
+							break;
+						}
+			
+			return extract(keep);
+		}
+		
+		// remove links that can't affect their targets and hidden nodes that can't affect
+		// the output, then shrink the storage. the outputs stay exactly the same
+		inline CompactReport compact()
+		{
+			materialize();
+			CompactReport res {0, std::vector<std::size_t>(mat.size())};
+			
+			const auto countLinks = [this]() {
+				std::size_t n = 0;
+				for (auto const &layer: mat)
+					for (Node const &node: layer)
+						n += node.links.size();
+				return n;
+			};
+			const auto eraseLinks = [](Node &node, auto const &inert) {
+				auto &links = node.links;
+				links.erase(std::remove_if(links.begin(), links.end(), inert), links.end());
+			};
+			const std::size_t prevLinks = countLinks();
+			
+			// w == c == 0 multiplies the target by exactly 1
+			for (auto &layer: mat)
+				for (Node &node: layer)
+					eraseLinks(node, [](Connection const &lnk) {
+						return lnk.w == 0.f && lnk.c == 0.f;
+					});
+			
+			// hidden nodes without inputs stay at s = c = 1, so their k == 1 links pass nothing
+			std::vector<std::vector<Integer>> incoming(mat.size());
+			for (Integer l = 0; l != mat.size(); ++l)
+				incoming[l].resize(mat[l].size());
+			for (Integer l = 0; l + 1 < mat.size(); ++l)
+			{
+				if (l > 0)
+					for (Integer n = 0; n != mat[l].size(); ++n)
+						if (incoming[l][n] == 0)
+							eraseLinks(mat[l][n], [](Connection const &lnk) {
+								return lnk.k == 1.f;
+							});
+				
+				for (Node const &node: mat[l])
+					for (auto const &lnk: node.links)
+						++incoming[lnk.addr.layer][lnk.addr.node];
+			}
+			
+			// hidden nodes without outputs are dead, which may kill the nodes feeding them
+			std::vector<std::vector<bool>> dead(mat.size());
+			for (Integer l = 0; l != mat.size(); ++l)
+				dead[l].resize(mat[l].size(), false);
+			for (Integer l = (Integer)mat.size() - 2; l > 0; --l)
+			{
+				for (Integer n = 0; n != mat[l].size(); ++n)
+				{
+					eraseLinks(mat[l][n], [&dead](Connection const &lnk) {
+						return dead[lnk.addr.layer][lnk.addr.node];
+					});
 					
-					for (; i < end; ++i)
-						node.links.push_back(Connection {k, w, c, NodeAddr {nLayer + 1, i}});
+					if (mat[l][n].links.empty()) {
+						dead[l][n] = true;
+						++res.nodes[l];
+					}
+				}
+			}
+			removeNodes(dead);
+			res.links = prevLinks - countLinks();
+			
+			for (auto &layer: mat)
+			{
+				for (Node &node: layer)
+					node.links.shrink_to_fit();
+				layer.shrink_to_fit();
+			}
+			return res;
+		}
+		
+		// permute the nodes of a layer, order[i] is the old index of the new i-th node.
+		// the links of every node are kept sorted by target so the writes of flow() walk
+		// the next layer forward. it only changes the order in which a target gets its
+		// products, so the outputs may differ by rounding (not for 0/1 signals)
+		inline void reorderLayer(Integer layer, std::vector<Integer> const &order)
+		{
+			assert(order.size() == mat[layer].size());
+			materialize();
+			
+			// the links are copied in the new order before the old ones are freed, so
+			// flow() reads them from memory laid out in the order it visits the nodes
+			std::vector<Integer> newIndex(order.size());
+			std::vector<Node> nodes(order.size());
+			for (Integer i = 0; i != order.size(); ++i)
+			{
+				newIndex[order[i]] = i;
+				nodes[i].links = mat[layer][order[i]].links;
+			}
+			mat[layer] = std::move(nodes);
+			
+			for (auto &l: mat)
+			{
+				for (Node &node: l)
+				{
+					bool touched = false;
+					for (auto &lnk: node.links)
+					{
+						if (lnk.addr.layer != layer)
+							continue;
+						lnk.addr.node = newIndex[lnk.addr.node];
+						touched = true;
+					}
+					if (touched)
+						std::stable_sort(node.links.begin(), node.links.end(), [](Connection const &a, Connection const &b) {
+							return a.addr.layer != b.addr.layer ? a.addr.layer < b.addr.layer : a.addr.node < b.addr.node;
+						});
 				}
 			}
 		}
 		
+		// node order of a layer sorted by the first target of every node,
+		// nodes writing to the same place become neighbours
+		inline std::vector<Integer> orderByTargets(Integer layer) const
+		{
+			if (hasImplicit())
+				return explicitCopy().orderByTargets(layer);
+			
+			std::vector<Integer> order(mat[layer].size());
+			for (Integer i = 0; i != order.size(); ++i)
+				order[i] = i;
+			
+			const auto key = [this, layer](Integer n) {
+				auto const &links = mat[layer][n].links;
+				return links.empty() ? NodeAddr {(Integer)mat.size(), 0} : links[0].addr;
+			};
+			std::stable_sort(order.begin(), order.end(), [&key](Integer a, Integer b) {
+				NodeAddr ka = key(a), kb = key(b);
+				return ka.layer != kb.layer ? ka.layer < kb.layer : ka.node < kb.node;
+			});
+			return order;
+		}
+		
+		// node order of a layer sorted lexicographically by the sorted sources of every
+		// node, nodes written by the same sources become neighbours
+		inline std::vector<Integer> orderBySources(Integer layer) const
+		{
+			if (hasImplicit())
+				return explicitCopy().orderBySources(layer);
+			
+			std::vector<std::vector<NodeAddr>> sources(mat[layer].size());
+			for (Integer l = 0; l != layer; ++l)
+				for (Integer n = 0; n != mat[l].size(); ++n)
+					for (auto const &lnk: mat[l][n].links)
+						if (lnk.addr.layer == layer)
+							sources[lnk.addr.node].push_back({l, n});
+			
+			// sources are collected in (layer, node) order already
+			const auto less = [](NodeAddr a, NodeAddr b) {
+				return a.layer != b.layer ? a.layer < b.layer : a.node < b.node;
+			};
+			std::vector<Integer> order(mat[layer].size());
+			for (Integer i = 0; i != order.size(); ++i)
+				order[i] = i;
+			std::stable_sort(order.begin(), order.end(), [&sources, &less](Integer a, Integer b) {
+				return std::lexicographical_compare(
+					sources[a].begin(), sources[a].end(),
+					sources[b].begin(), sources[b].end(),
+					less
+				);
+			});
+			return order;
+		}
+		
 		static inline float normalize(float value)
 		{
 			// avoid NaN and inf
@@ -269,60 +1182,130 @@ namespace kpsm2sk
 			return 0.f;
 		}
 			
-		inline void reset(Integer nLayer) {
-			for (Node &node: mat[nLayer]) {
-				node.s = 1.f;
-				node.c = 1.f;
+		inline void flow(Integer nLayer, ActivationState &st) const {
+			LayerShape const *shape = nLayer < shapes.size() && shapes[nLayer].kind != LayerShape::Explicit ? &shapes[nLayer] : nullptr;
+			const Integer next = mat[nLayer + 1].size();
+			
+			for (Integer n = 0; n != mat[nLayer].size(); ++n) {
+				float s = st.signal({nLayer, n});
+				float c = st.conductivity({nLayer, n});
+				
+				if (shape && shape->implicit(n)) {
+					// targets follow from the shape, k, w, c are the same for all or in its matrix
+					const Integer beg = shape->targetBeg(n), end = shape->targetEnd(n, next);
+					if (shape->params.empty()) {
+						float tmp = shape->k + s - 2.f * s * shape->k;
+						tmp *= c;
+						for (Integer i = beg; i < end; ++i) {
+							Activation &dst = st.touch({nLayer + 1, i});
+							dst.s *= 1.f - shape->w * tmp;
+							dst.c *= 1.f - shape->c * tmp;
+						}
+					}
+					else if (beg < end) {
+						float const *p = &shape->params[shape->param(n, beg)];
+						for (Integer i = beg; i < end; ++i, p += 3) {
+							float tmp = p[0] + s - 2.f * s * p[0];
+							tmp *= c;
+							Activation &dst = st.touch({nLayer + 1, i});
+							dst.s *= 1.f - p[1] * tmp;
+							dst.c *= 1.f - p[2] * tmp;
+						}
+					}
+					continue;
+				}
+				
+				for (auto const &lnk: mat[nLayer][n].links) {
+					float tmp = lnk.k + s - 2.f * s * lnk.k;
+					tmp *= c;
+					/* if (lnk.w * tmp > 0.07f)
+						std::cout << "oh my nasty {" << lnk.addr.layer  << ", " << lnk.addr.node << "} (" << lnk.k << ", " << lnk.w << "), " << s << " (" << n << ")\n"; */
+					
+					Activation &dst = st.touch(lnk.addr);
+					dst.s *= 1.f - lnk.w * tmp;
+					dst.c *= 1.f - lnk.c * tmp;
+				}
 			}
 		}
-		inline void reset() {
-			for (auto &node: mat[0]) {
-				node.c = 1.f;
+		inline void flow(ActivationState &st) const {
+			for (Integer i = 0; i + 1 < mat.size(); ++i) {
+				flow(i, st);
 			}
-			for (Integer i = 1; i < mat.size(); ++i) {
-				reset(i);
+		}
+		inline void run(ActivationState &st) const {
+			st.reset();
+			flow(st);
+		}
+		
+		inline void loadInput(ActivationState &st, const std::vector<float> &input) const {
+			for (Integer i = 0; i != input.size(); ++i) {
+				st.setSignal({0, i}, input[i]);
 			}
 		}
-		inline void flow(Integer nLayer) {
-			for (Node &node: mat[nLayer]) {
-				for (auto &lnk: node.links) {
-					float tmp = lnk.k + node.s - 2.f * node.s * lnk.k;
-					tmp *= node.c;
-					/* if (lnk.w * tmp > 0.07f)
-						std::cout << "oh my nasty {" << lnk.addr.layer  << ", " << lnk.addr.node << "} (" << lnk.k << ", " << lnk.w << "), " << node.s << " (" << (&node - mat[nLayer].data()) << ")\n"; */
-						
-					(*this)[lnk.addr].s *= 1.f - lnk.w * tmp;
-					(*this)[lnk.addr].c *= 1.f - lnk.c * tmp;
-				}
+		
+		inline void loadInput(ActivationState &st, TuneView const &data, Integer row) const
+		{
+			if (data.sparse())
+			{
+				st.clearInput();
+				for (uint32_t i = data.sparseBeg[row]; i != data.sparseBeg[row + 1]; ++i)
+					st.setSignal({0, (Integer)data.sparseIdx[i]}, 1.f);
+			}
+			else
+			{
+				float const *input = data.input + (std::size_t)row * data.inputs;
+				for (Integer i = 0; i != data.inputs; ++i)
+					st.setSignal({0, i}, input[i]);
 			}
 		}
+		
+		// the same on the own state of the network
+		inline void reset(Integer nLayer) {
+			state.fit(*this);
+			state.reset(nLayer);
+		}
+		inline void reset() {
+			state.fit(*this);
+			state.reset();
+		}
+		inline void flow(Integer nLayer) {
+			state.fit(*this);
+			flow(nLayer, state);
+		}
 		inline void flow() {
-			for (Integer i = 0; i + 1 < mat.size(); ++i) {
-				flow(i);
-			}
+			state.fit(*this);
+			flow(state);
 		}
 		inline void run() {
-			reset();
-			flow();
-		}		
-		
+			state.fit(*this);
+			run(state);
+		}
 		inline void loadInput(const std::vector<float> &input) {
-			for (Integer i = 0; i != input.size(); ++i) {
-				mat[0][i].s = input[i];
-			}
+			state.fit(*this);
+			loadInput(state, input);
 		}
 		
-		inline float calculateError(const std::vector<tuneSet> &tuneData)
+		inline void loadInput(TuneView const &data, Integer row) {
+			state.fit(*this);
+			loadInput(state, data, row);
+		}
+		
+		inline float signal(NodeAddr i) const {
+			return state.signal(i);
+		}
+		
+		inline float calculateError(TuneView const &tuneData)
 		{
 			float err = 0.f;
 			
-			for (Integer i = 0; i != tuneData.size(); ++i)
+			for (Integer i = 0; i != tuneData.rows; ++i)
 			{
-				loadInput(tuneData[i].input);
+				loadInput(tuneData, i);
 				run();
+				float const *output = tuneData.outputRow(i);
 				for (Integer n = 0; n != mat.back().size(); ++n)
 				{
-					float diff = mat.back()[n].s - tuneData[i].output[n];
+					float diff = signal({layers() - 1, n}) - output[n];
 					err += diff * diff;
 				}
 			}
@@ -340,7 +1323,7 @@ namespace kpsm2sk
 			}
 			for (Integer n = 0; n != mat.back().size(); ++n)
 			{
-				float diff = mat.back()[n].s - expOutput[n];
+				float diff = signal({layers() - 1, n}) - expOutput[n];
 				err += diff * diff;
 			}
 			return err;
@@ -349,28 +1332,29 @@ namespace kpsm2sk
 		// get new value for given property of the link to output signal as expected (or as near as possible)
 		inline float solveDelta(NodeAddr addr, Integer numLink, float expSignal, ConProperty prop)
 		{
-			const Node &node = (*this)[addr];
-			const auto &lnk = node.links[numLink];
+			const Connection lnk = link(addr, numLink);
+			const float s = state.signal(addr);
+			const float c = state.conductivity(addr);
 			
 			if (prop == ConProperty::K)
 			{
-				float compExp = (1.f - expSignal) / (lnk.w * node.c);
+				float compExp = (1.f - expSignal) / (lnk.w * c);
 				
-				// compExp == expK + node.s - 2.f * node.s * expK
-				// expK - 2.f * node.s * expK == compExp - node.s
-				// expK * (1 - 2 * node.s) == compExp - node.s
+				// compExp == expK + s - 2.f * s * expK
+				// expK - 2.f * s * expK == compExp - s
+				// expK * (1 - 2 * s) == compExp - s
 				
-				float expK = (compExp - node.s) / (1.f - 2.f * node.s);
+				float expK = (compExp - s) / (1.f - 2.f * s);
 				return normalize(expK);
 			}
 			// if (prop == ConProperty::W)
 			{
-				float prop = (1.f - expSignal) / (node.c * (lnk.k + node.s - 2.f * node.s * lnk.k));
+				float prop = (1.f - expSignal) / (c * (lnk.k + s - 2.f * s * lnk.k));
 				return normalize(prop);
 			}
 			// if (prop == ConProperty::C)
 			// {
-			// 	float prop = (1.f - expSignal) / (node.c * (lnk.k + node.s - 2.f * node.s * lnk.k));
+			// 	float prop = (1.f - expSignal) / (c * (lnk.k + s - 2.f * s * lnk.k));
 			// 	return normalize(prop);
 			// }
 		}
@@ -382,51 +1366,57 @@ namespace kpsm2sk
 		inline float predictSignal(NodeAddr addr, std::vector<float> const &expOutput)
 		{
 			assert(expOutput.size() == mat.back().size());
-			
+			return predictSignal(addr, expOutput.data());
+		}
+		
+		// expOutput holds a value for every output node
+		inline float predictSignal(NodeAddr addr, float const *expOutput)
+		{
 			if (addr.layer + 1 == mat.size())
 				return expOutput[addr.node];
 			
 			// @todo calculate when expOutput.size() > 1
-			if (expOutput.size() != 1 || addr.layer + 2 != mat.size())
-				return (*this)[addr].s;
+			if (mat.back().size() != 1 || addr.layer + 2 != mat.size())
+				return state.signal(addr);
 			
-			const Node &node = (*this)[addr];
-			const auto &lnk = node.links[0];
+			const Connection lnk = link(addr, 0);
+			const float s = state.signal(addr);
+			const float c = state.conductivity(addr);
 			{
-				float curSignal = 1.f - lnk.w * node.c * (lnk.k + node.s - 2.f * node.s * lnk.k);
+				float curSignal = 1.f - lnk.w * c * (lnk.k + s - 2.f * s * lnk.k);
 				// get the output as if the node didn't affect it
-				float clearOutput = mat.back()[0].s / curSignal;
+				float clearOutput = signal({layers() - 1, 0}) / curSignal;
 				float expSignal = expOutput[0] / clearOutput;
 				
-				float compExp = (1.f - expSignal) / (lnk.w * node.c);
+				float compExp = (1.f - expSignal) / (lnk.w * c);
 				
 				// compExp == lnk.k + expS - 2.f * expS * lnk.k
 				// expS - 2 * expS * lnk.k == compExp - lnk.k
 				// expS * (1 - 2 * lnk.k) == compExp - lnk.k
 				
 				float expS = (compExp - lnk.k) / (1.f - 2.f * lnk.k);
-				// std::cout << "l: " << addr.layer << " n: " << addr.node << " expS: " << expS << "node.s: " << node.s << '\n';
+				// std::cout << "l: " << addr.layer << " n: " << addr.node << " expS: " << expS << "s: " << s << '\n';
 				return expS;
 			}
 		}
 			
 		// collect tuning summary for links of given node
-		inline std::vector<std::vector<float>> collectTuningSummary(NodeAddr addr, ConProperty prop, const std::vector<tuneSet> &tuneData)
+		inline std::vector<std::vector<float>> collectTuningSummary(NodeAddr addr, ConProperty prop, TuneView const &tuneData)
 		{
-			Node &node = (*this)[addr];
-			std::vector<std::vector<float>> tuneSmr(node.links.size());
+			const Integer links = linkCount(addr);
+			std::vector<std::vector<float>> tuneSmr(links);
 			
 			for (auto &tset: tuneSmr)
-				tset.reserve(tuneData.size());
+				tset.reserve(tuneData.rows);
 			
-			for (const auto &set: tuneData)
+			for (Integer row = 0; row != tuneData.rows; ++row)
 			{
-				loadInput(set.input);
+				loadInput(tuneData, row);
 				run();
 				
-				for (Integer i = 0; i < node.links.size(); ++i)
+				for (Integer i = 0; i < links; ++i)
 				{
-					float sig = predictSignal(node.links[i].addr, set.output);
+					float sig = predictSignal(link(addr, i).addr, tuneData.outputRow(row));
 					float p = solveDelta(addr, i, sig, prop);
 					tuneSmr[i].push_back(p);
 				}
@@ -434,28 +1424,27 @@ namespace kpsm2sk
 			return tuneSmr;
 		}
 		
-		inline std::vector<float> collectTuningSummary(LinkAddr addr, ConProperty prop, const std::vector<tuneSet> &tuneData)
+		inline std::vector<float> collectTuningSummary(LinkAddr addr, ConProperty prop, TuneView const &tuneData)
 		{
-			Connection &lnk = mat[addr.layer][addr.node].links[addr.link];
+			const Connection lnk = link({addr.layer, addr.node}, addr.link);
 			std::vector<float> tuneSmr;
 			
-			tuneSmr.reserve(tuneData.size());
+			tuneSmr.reserve(tuneData.rows);
 			
-			for (const auto &set: tuneData)
+			for (Integer row = 0; row != tuneData.rows; ++row)
 			{
-				loadInput(set.input);
+				loadInput(tuneData, row);
 				run();
 				
-				float sig = predictSignal(lnk.addr, set.output);
+				float sig = predictSignal(lnk.addr, tuneData.outputRow(row));
 				float p = solveDelta({addr.layer, addr.node}, addr.link, sig, prop);
 				tuneSmr.push_back(p);
 			}
 			return tuneSmr;
 		}
 		
-		inline float tuneDeep(NodeAddr addr, Integer numLink, ConProperty prop, const std::vector<tuneSet> &tuneData, float learnMul)
+		inline float tuneDeep(NodeAddr addr, Integer numLink, ConProperty prop, TuneView const &tuneData, float learnMul)
 		{
-			Connection &lnk = mat[addr.layer][addr.node].links[numLink];
 			std::vector<float> tuneSmr = collectTuningSummary({addr.layer, addr.node, numLink}, prop, tuneData);
 			
 			float avg = 0.f, min = 1.f, max = 0.f;
@@ -467,11 +1456,7 @@ namespace kpsm2sk
 			}
 			avg /= tuneSmr.size();
 			
-			float &p = (
-				prop == ConProperty::K ? lnk.k :
-			 	prop == ConProperty::W ? lnk.w :
-			 	lnk.c
-			);
+			float &p = param({addr.layer, addr.node, numLink}, prop);
 			
 			float diff = (1.f + min - max) * (avg - p) * learnMul;
 			p = normalize(p + diff);
@@ -480,30 +1465,30 @@ namespace kpsm2sk
 		}
 		
 		// @todo idea: try 1-3-1 network architecture
-		inline float tuneDeep(NodeAddr addr, ConProperty prop, const std::vector<tuneSet> &tuneData, float learnMul)
+		inline float tuneDeep(NodeAddr addr, ConProperty prop, TuneView const &tuneData, float learnMul)
 		{
-			Node &node = (*this)[addr];
+			const Integer links = linkCount(addr);
 			
 			float res = 0.f;
-			for (Integer i = 0; i != node.links.size(); ++i)
+			for (Integer i = 0; i != links; ++i)
 				res += tuneDeep(addr, i, prop, tuneData, learnMul);
 			
-			res /= node.links.size();
+			res /= links;
 			return res;
 		}
 		
-		inline tuneResult tuneShallow(NodeAddr addr, ConProperty prop, const std::vector<tuneSet> &tuneData, float learnMul)
+		inline tuneResult tuneShallow(NodeAddr addr, ConProperty prop, TuneView const &tuneData, float learnMul)
 		{
 			float currentErr = calculateError(tuneData);
 			Integer fails = 0;
 			Integer total = 0;
 			std::mt19937 rgen;
 			
-			Node &node = (*this)[addr];
-			for (auto &lnk: node.links)
+			const Integer links = linkCount(addr);
+			for (Integer i = 0; i != links; ++i)
 			{
 				++total;
-				float &value = prop == ConProperty::K ? lnk.k : prop == ConProperty::W ? lnk.w : lnk.c;
+				float &value = param({addr.layer, addr.node, i}, prop);
 				float prevValue = value;
 				float err;
 				
@@ -542,6 +1527,275 @@ namespace kpsm2sk
 			}
 			return {fails, total};
 		}
+		
+		// the same on samples kept as vectors, copied into one dataset first
+		inline float calculateError(const std::vector<tuneSet> &tuneData) {
+			return calculateError(TuneDataset(tuneData).view());
+		}
+		inline std::vector<std::vector<float>> collectTuningSummary(NodeAddr addr, ConProperty prop, const std::vector<tuneSet> &tuneData) {
+			return collectTuningSummary(addr, prop, TuneDataset(tuneData).view());
+		}
+		inline std::vector<float> collectTuningSummary(LinkAddr addr, ConProperty prop, const std::vector<tuneSet> &tuneData) {
+			return collectTuningSummary(addr, prop, TuneDataset(tuneData).view());
+		}
+		inline float tuneDeep(NodeAddr addr, Integer numLink, ConProperty prop, const std::vector<tuneSet> &tuneData, float learnMul) {
+			return tuneDeep(addr, numLink, prop, TuneDataset(tuneData).view(), learnMul);
+		}
+		inline float tuneDeep(NodeAddr addr, ConProperty prop, const std::vector<tuneSet> &tuneData, float learnMul) {
+			return tuneDeep(addr, prop, TuneDataset(tuneData).view(), learnMul);
+		}
+		inline tuneResult tuneShallow(NodeAddr addr, ConProperty prop, const std::vector<tuneSet> &tuneData, float learnMul) {
+			return tuneShallow(addr, prop, TuneDataset(tuneData).view(), learnMul);
+		}
+	};
+	
+	inline void ActivationState::fit(Network const &net)
+	{
+		layers.resize(net.mat.size());
+		epochs.resize(net.mat.size(), 1);
+		for (Integer i = 0; i != layers.size(); ++i)
+			layers[i].resize(net.mat[i].size(), Activation {0.f, 0.f, 0});
+	}
+	
+	// evaluation of networks whose links all have k = 0 or 1, w = 1 and c = 0 (or are inert)
+	// on 0/1 inputs. the conductivities then stay 1 and a node is just the AND of its sources,
+	// negated for k = 0. every node is a Word with one bit per context, so as many contexts
+	// as the Word has bits are evaluated at once
+	template <typename Word = uint64_t>
+	class LogicNetwork
+	{
+	public:
+		static constexpr Integer lanes = sizeof(Word) * 8;
+		
+		struct Source
+		{
+			Integer node; // flat index
+			Word flip;    // all bits set for k = 0
+		};
+		
+		std::vector<Integer> layerBeg;  // flat index of the first node of every layer, then the total
+		std::vector<Integer> sourceBeg; // sources of every flat node, then the end
+		std::vector<Source> sources;
+		
+		// bits of every node by flat index
+		using State = std::vector<Word>;
+		
+		static inline bool isLogic(Network const &net)
+		{
+			if (net.hasImplicit())
+				return isLogic(net.explicitCopy());
+			
+			for (Integer l = 0; l != net.mat.size(); ++l)
+				for (Node const &node: net.mat[l])
+					for (auto const &lnk: node.links)
+					{
+						if (lnk.w == 0.f && lnk.c == 0.f)
+							continue;
+						if (lnk.w != 1.f || lnk.c != 0.f || (lnk.k != 0.f && lnk.k != 1.f))
+							return false;
+						if (lnk.addr.layer <= l)
+							return false;
+					}
+			return true;
+		}
+		
+		inline LogicNetwork() = default;
+		
+		// freeze the topology, net must pass isLogic
+		inline explicit LogicNetwork(Network const &net)
+		{
+			if (net.hasImplicit()) {
+				*this = LogicNetwork(net.explicitCopy());
+				return;
+			}
+			assert(isLogic(net));
+			
+			layerBeg.resize(net.mat.size() + 1);
+			for (Integer l = 0; l != net.mat.size(); ++l)
+				layerBeg[l + 1] = layerBeg[l] + net.mat[l].size();
+			
+			// gather the links by target, in the order flow() would apply them
+			sourceBeg.assign(layerBeg.back() + 1, 0);
+			for (auto const &layer: net.mat)
+				for (Node const &node: layer)
+					for (auto const &lnk: node.links)
+						if (lnk.w != 0.f)
+							++sourceBeg[index(lnk.addr) + 1];
+			for (Integer i = 0; i != layerBeg.back(); ++i)
+				sourceBeg[i + 1] += sourceBeg[i];
+			
+			sources.resize(sourceBeg.back());
+			std::vector<Integer> fill(sourceBeg.begin(), sourceBeg.end() - 1);
+			for (Integer l = 0; l != net.mat.size(); ++l)
+				for (Integer n = 0; n != net.mat[l].size(); ++n)
+					for (auto const &lnk: net.mat[l][n].links)
+						if (lnk.w != 0.f)
+							sources[fill[index(lnk.addr)]++] = {
+								layerBeg[l] + n,
+								lnk.k == 0.f ? ~Word(0) : Word(0)
+							};
+		}
+		
+		inline Integer index(NodeAddr i) const {
+			return layerBeg[i.layer] + i.node;
+		}
+		
+		inline State makeState() const {
+			return State(layerBeg.back(), Word(0));
+		}
+		
+		inline void clearInput(State &st) const {
+			std::fill(st.begin(), st.begin() + layerBeg[1], Word(0));
+		}
+		inline void setInput(State &st, Integer node, Integer lane, bool on = true) const
+		{
+			if (on)
+				st[node] |= Word(1) << lane;
+			else
+				st[node] &= ~(Word(1) << lane);
+		}
+		
+		inline void run(State &st) const
+		{
+			for (Integer i = layerBeg[1]; i != layerBeg.back(); ++i)
+			{
+				Word v = ~Word(0);
+				for (Integer j = sourceBeg[i]; j != sourceBeg[i + 1]; ++j)
+					v &= st[sources[j].node] ^ sources[j].flip;
+				st[i] = v;
+			}
+		}
+		
+		inline bool signal(State const &st, NodeAddr i, Integer lane) const {
+			return (st[index(i)] >> lane) & 1;
+		}
+		// number of contexts in which the node is on
+		inline Integer activeLanes(State const &st, NodeAddr i) const {
+			return std::bitset<lanes>(st[index(i)]).count();
+		}
+	};
+	
+	// a value published as immutable versions. readers pin the current version without
+	// blocking or copying, a writer builds the next version aside and publishes it at once.
+	// a replaced version is freed on the writer side, by the next publish or reclaim, once no
+	// reader that could have seen it is pinned anymore. every reader thread uses its own slot,
+	// so their number is fixed upfront
+	template <typename T>
+	class Versioned
+	{
+	protected:
+		struct alignas(64) Slot
+		{
+			std::atomic<uint64_t> epoch {0}; // publication epoch seen when pinned, 0 if idle
+		};
+		struct Retired
+		{
+			T const *value;
+			uint64_t epoch; // first epoch whose readers can't see the value
+		};
+		
+		std::atomic<T const *> pCurrent;
+		std::atomic<uint64_t> pEpoch {1};
+		std::unique_ptr<Slot[]> pSlots;
+		std::size_t pReaders;
+		
+		std::mutex pWriter;
+		std::vector<Retired> pRetired;
+		
+	public:
+		class Pin
+		{
+		protected:
+			Slot *pSlot = nullptr;
+			T const *pValue = nullptr;
+			
+		public:
+			inline Pin(Slot *slot, T const *value): pSlot(slot), pValue(value) {}
+			inline Pin(Pin &&oth): pSlot(oth.pSlot), pValue(oth.pValue) {
+				oth.pSlot = nullptr;
+			}
+			Pin(Pin const &) = delete;
+			Pin &operator =(Pin const &) = delete;
+			
+			inline ~Pin()
+			{
+				if (pSlot)
+					pSlot->epoch.store(0);
+			}
+			
+			inline T const &operator *() const { return *pValue; }
+			inline T const *operator ->() const { return pValue; }
+		};
+		
+		inline Versioned(std::size_t readers, std::unique_ptr<T> initial):
+			pCurrent(initial.release()),
+			pSlots(new Slot[readers]),
+			pReaders(readers)
+		{}
+		
+		Versioned(Versioned const &) = delete;
+		Versioned &operator =(Versioned const &) = delete;
+		
+		inline ~Versioned()
+		{
+			delete pCurrent.load();
+			for (auto const &r: pRetired)
+				delete r.value;
+		}
+		
+		// keep the current version alive until the pin is gone, one pin per reader at a time
+		inline Pin pin(std::size_t reader)
+		{
+			assert(reader < pReaders);
+			Slot &slot = pSlots[reader];
+			slot.epoch.store(pEpoch.load());
+			return Pin(&slot, pCurrent.load());
+		}
+		
+		// the current version as seen by the writer, which is the only one replacing it
+		inline T const &current() const {
+			return *pCurrent.load();
+		}
+		
+		inline void publish(std::unique_ptr<T> next)
+		{
+			std::lock_guard lock(pWriter);
+			T const *prev = pCurrent.exchange(next.release());
+			// readers pinning from now on will see the new version
+			uint64_t epoch = pEpoch.fetch_add(1) + 1;
+			pRetired.push_back({prev, epoch});
+			reclaimLocked();
+		}
+		
+		// free the retired versions nobody can see, returns how many are left
+		inline std::size_t reclaim()
+		{
+			std::lock_guard lock(pWriter);
+			return reclaimLocked();
+		}
+		
+	protected:
+		inline std::size_t reclaimLocked()
+		{
+			uint64_t oldest = UINT64_MAX;
+			for (std::size_t i = 0; i != pReaders; ++i)
+			{
+				uint64_t e = pSlots[i].epoch.load();
+				if (e != 0 && e < oldest)
+					oldest = e;
+			}
+			
+			auto keep = pRetired.begin();
+			for (auto &r: pRetired)
+			{
+				if (r.epoch <= oldest)
+					delete r.value;
+				else
+					*keep++ = r;
+			}
+			pRetired.erase(keep, pRetired.end());
+			return pRetired.size();
+		}
 	};
 }
 
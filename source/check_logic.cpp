@@ -0,0 +1,85 @@
+#include <kpsm2sk.hpp>
+
+#include <cstdio>
+#include <vector>
+#include <random>
+
+// the bit-parallel engine has to give the signals of Network::run on every node,
+// for every lane of a batch of random contexts
+
+using namespace kpsm2sk;
+using Logic = LogicNetwork<>;
+
+// random 0/1 network: k of 0 or 1, w = 1, c = 0, with some inert links in between
+static Network makeNetwork(std::vector<Integer> const &config, std::mt19937 &rgen)
+{
+	Network net;
+	net.mat.resize(config.size());
+	for (Integer l = 0; l != config.size(); ++l)
+		net.mat[l].resize(config[l]);
+	
+	for (Integer l = 0; l + 1 < config.size(); ++l)
+	{
+		for (Node &node: net.mat[l])
+		{
+			for (Integer i = 0; i != config[l + 1]; ++i)
+			{
+				if (rgen() % 3 != 0)
+					continue;
+				Connection lnk {(float)(rgen() % 2), 1.f, 0.f, NodeAddr {l + 1, i}};
+				if (rgen() % 5 == 0)
+					lnk.w = 0.f;
+				node.links.push_back(lnk);
+			}
+		}
+	}
+	return net;
+}
+
+static int check(Network const &net, std::mt19937 &rgen, const char *name)
+{
+	if (!Logic::isLogic(net)) {
+		std::printf("%s: not a logic network\n", name);
+		return 1;
+	}
+	Logic logic(net);
+	
+	std::vector<std::vector<bool>> inputs(Logic::lanes, std::vector<bool>(net.mat[0].size()));
+	auto bits = logic.makeState();
+	for (Integer lane = 0; lane != Logic::lanes; ++lane)
+		for (Integer i = 0; i != net.mat[0].size(); ++i)
+			logic.setInput(bits, i, lane, inputs[lane][i] = rgen() % 2);
+	logic.run(bits);
+	
+	ActivationState st(net);
+	int mismatches = 0;
+	for (Integer lane = 0; lane != Logic::lanes; ++lane)
+	{
+		std::vector<float> input(inputs[lane].begin(), inputs[lane].end());
+		net.loadInput(st, input);
+		net.run(st);
+		for (Integer l = 0; l != net.mat.size(); ++l)
+			for (Integer n = 0; n != net.mat[l].size(); ++n)
+				if (st.signal({l, n}) != (logic.signal(bits, {l, n}, lane) ? 1.f : 0.f))
+					++mismatches;
+	}
+	std::printf("%s: %d mismatches\n", name, mismatches);
+	return mismatches != 0;
+}
+
+int main()
+{
+	std::mt19937 rgen(1);
+	int res = 0;
+	
+	for (int i = 0; i != 20; ++i)
+		res |= check(makeNetwork({12, 30, 20, 8}, rgen), rgen, "random");
+	
+	// the layers held as shapes are frozen from their links
+	using Storage = Network::LinkStorage;
+	res |= check(Network({10, 16, 6}, 1.f, 1.f, 0.f, Storage::Shape), rgen, "dense");
+	res |= check(Network({10, 16, 6}, {3, 2}, 0.f, 1.f, 0.f, Storage::Shape), rgen, "banded");
+	res |= check(Network({10, 16, 6}, {3, 2}, 0.f, 1.f, 0.f, Storage::Matrix), rgen, "banded matrix");
+	
+	return res;
+}
\ No newline at end of file
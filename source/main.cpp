@@ -2,6 +2,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <kpsm2sk.hpp>
+#include <cecfg.hpp>
 
 #include <cstdlib>
 #include <cstdio>
@@ -15,8 +16,34 @@
 #include <chrono>
 #include <thread>
 #include <stdexcept>
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <unordered_map>
 
-int g_inputWords = 3;
+struct TextMemory
+{
+	std::size_t words;
+	std::size_t vocBytes;     // string objects and their heap buffers
+	std::size_t indexBytes;   // word lookup table
+	std::size_t seqBytes;
+	std::size_t pointsBytes;
+	std::size_t overhead;     // estimated allocator overhead
+	
+	inline std::size_t total() const {
+		return vocBytes + indexBytes + seqBytes + pointsBytes + overhead;
+	}
+	
+	inline void print(std::ostream &os) const
+	{
+		os << "vocabulary: " << words << " words, " << vocBytes << " B, index: " << indexBytes << " B\n"
+			<< "seq: " << seqBytes << " B, points: " << pointsBytes << " B, ~"
+			<< overhead << " B allocator overhead\n"
+			<< "text total: " << total() << " B\n";
+	}
+};
 
 class Text
 {
@@ -24,6 +51,10 @@ public:
 	std::vector<std::string> voc;
 	std::vector<int> seq;
 	std::vector<bool> points;
+	std::unordered_map<std::string, int> index; // id of every vocabulary word
+	
+	long fileBytes = 0;   // size of the last loaded file
+	long loadedBytes = 0; // part of it that was tokenized
 	
 	std::string const &operator [](float ind) {
 		auto i = (int)(ind * voc.size());
@@ -53,23 +84,148 @@ public:
 		if (wbeg == wend) return;
 		
 		std::string newst(wbeg, wend - wbeg);
-		int num = -1;
-		// @todo optimize
-		for (int i = 0; i != voc.size(); ++i) {
-			if (voc[i] == newst) {
-				num = i;
-				break;
+		auto [iter, added] = index.try_emplace(newst, (int)voc.size());
+		if (added)
+			voc.push_back(std::move(newst));
+		seq.push_back(iter->second);
+		points.push_back(haspoint);
+	}
+	
+	inline TextMemory memoryUsage() const
+	{
+		using kpsm2sk::allocOverhead;
+		
+		TextMemory res {};
+		res.words = voc.size();
+		res.vocBytes = voc.capacity() * sizeof(std::string);
+		if (voc.capacity() != 0)
+			res.overhead += allocOverhead;
+		
+		const std::size_t inplace = std::string().capacity();
+		for (auto const &w: voc)
+		{
+			// short strings live inside the object
+			if (w.capacity() > inplace) {
+				res.vocBytes += w.capacity() + 1;
+				res.overhead += allocOverhead;
 			}
 		}
-		if (num == -1) {
-			num = voc.size();
-			voc.push_back(std::move(newst));
+		
+		// a node per entry (key copy, value, next pointer, cached hash) and the bucket array
+		res.indexBytes = index.bucket_count() * sizeof(void *);
+		for (auto const &[word, id]: index)
+		{
+			res.indexBytes += sizeof(word) + sizeof(id) + sizeof(void *) + sizeof(std::size_t);
+			res.overhead += allocOverhead;
+			if (word.capacity() > inplace) {
+				res.indexBytes += word.capacity() + 1;
+				res.overhead += allocOverhead;
+			}
 		}
-		seq.push_back(num);
-		points.push_back(haspoint);
+		if (index.bucket_count() != 0)
+			res.overhead += allocOverhead;
+		
+		res.seqBytes = seq.capacity() * sizeof(int);
+		if (seq.capacity() != 0)
+			res.overhead += allocOverhead;
+		res.pointsBytes = (points.capacity() + 7) / 8;
+		if (points.capacity() != 0)
+			res.overhead += allocOverhead;
+		
+		return res;
 	}
 	
-	int loadFile(const char *file)
+	// renumber the vocabulary by descending frequency so the nodes of hot words end up
+	// close to each other. words seen less than minCount times share one "<unk>" id.
+	// returns the new id of every old one
+	inline std::vector<int> sortByFrequency(int minCount = 0)
+	{
+		struct Entry
+		{
+			int count;
+			int first; // old id, for a stable order of equally frequent words
+			std::vector<int> ids;
+		};
+		
+		std::vector<int> count(voc.size());
+		for (int w: seq)
+			++count[w];
+		
+		std::vector<Entry> entries;
+		Entry unk {0, (int)voc.size(), {}};
+		for (int i = 0; i != voc.size(); ++i)
+		{
+			if (count[i] >= minCount)
+				entries.push_back({count[i], i, {i}});
+			else {
+				unk.count += count[i];
+				unk.first = std::min(unk.first, i);
+				unk.ids.push_back(i);
+			}
+		}
+		if (!unk.ids.empty())
+			entries.push_back(std::move(unk));
+		
+		std::sort(entries.begin(), entries.end(), [](Entry const &a, Entry const &b) {
+			return a.count != b.count ? a.count > b.count : a.first < b.first;
+		});
+		
+		std::vector<int> remap(voc.size());
+		std::vector<std::string> newVoc;
+		newVoc.reserve(entries.size());
+		for (auto const &e: entries)
+		{
+			for (int i: e.ids)
+				remap[i] = newVoc.size();
+			newVoc.push_back(e.ids.size() == 1 && count[e.ids[0]] >= minCount ? std::move(voc[e.ids[0]]) : "<unk>");
+		}
+		voc = std::move(newVoc);
+		
+		for (int &w: seq)
+			w = remap[w];
+		
+		// rare words stay known, now as "<unk>"
+		for (auto &[word, id]: index)
+			id = remap[id];
+		
+		return remap;
+	}
+	
+	// turn everything but letters and points into spaces
+	static inline void normalize(char *beg, char *end)
+	{
+		for (; beg != end; ++beg)
+		{
+			if (!isLetter(*beg) && *beg != '.')
+				*beg = ' ';
+			*beg = toLower(*beg);
+		}
+	}
+	
+	// add the words of a normalized buffer, up to maxWords in total (0 for no limit).
+	// returns the bytes consumed
+	inline std::size_t addWords(const char *buf, std::size_t size, std::size_t maxWords = 0)
+	{
+		std::size_t wbeg = 0;
+		while (maxWords == 0 || seq.size() < maxWords)
+		{
+			while (wbeg < size && buf[wbeg] == ' ')
+				wbeg++;
+			std::size_t wend = wbeg;
+			while (wend < size && buf[wend] != ' ')
+				wend++;
+			if (wend != wbeg)
+			{
+				addWord(buf + wbeg, buf + wend);
+				wbeg = wend;
+			}
+			else break;
+		}
+		return wbeg;
+	}
+	
+	// maxWords limits tokenization to a prefix of the file, 0 reads everything
+	int loadFile(const char *file, std::size_t maxWords = 0)
 	{
 		FILE *fish = fopen(file, "rb");
 		if (!fish)
@@ -85,70 +241,307 @@ public:
 		fread(buf, 1, fsize, fish);
 		
 		fclose(fish);
-		for (int i = 0; i < fsize; ++i)
-		{
-			if (!isLetter(buf[i]) && buf[i] != '.')
-				buf[i] = ' ';
-			buf[i] = toLower(buf[i]);
-		}
+		fileBytes = fsize;
+		normalize(buf, buf + fsize);
+		loadedBytes = addWords(buf, fsize, maxWords);
+		
+		delete[] buf;
+		return 0;
+	}
+	
+	// words tokenized since the previous chunk
+	struct Chunk
+	{
+		std::vector<std::string> words; // new vocabulary, continuing the ids
+		std::vector<int> seq;
+		std::vector<bool> points;
+	};
+	
+	// tokenize the file by about chunkBytes and hand over every chunk to sink as soon as
+	// it is read. this text only keeps the vocabulary
+	template <typename Sink>
+	int streamFile(const char *file, std::size_t chunkBytes, Sink &&sink)
+	{
+		FILE *fish = fopen(file, "rb");
+		if (!fish)
+			return 1;
+		
+		std::vector<char> buf;
+		std::size_t carry = 0; // unfinished word from the previous chunk
+		std::size_t knownWords = voc.size();
+		bool empty = true;
 		
-		int wbeg = 0;
 		while (true)
 		{
-			while (wbeg < fsize && buf[wbeg] == ' ')
-				wbeg++;
-			int wend = wbeg;
-			while (wend < fsize && buf[wend] != ' ')
-				wend++;
-			if (wend != wbeg)
-			{
-				addWord(buf + wbeg, buf + wend);
-				wbeg = wend;
-			}
-			else break;
+			buf.resize(carry + chunkBytes);
+			std::size_t got = fread(buf.data() + carry, 1, chunkBytes, fish);
+			bool last = got < chunkBytes;
+			if (got != 0)
+				empty = false;
+			normalize(buf.data() + carry, buf.data() + carry + got);
+			
+			std::size_t size = carry + got;
+			std::size_t cut = size;
+			if (!last)
+				while (cut > 0 && buf[cut - 1] != ' ')
+					--cut;
+			
+			addWords(buf.data(), cut);
+			fileBytes += got;
+			loadedBytes += cut;
+			
+			Chunk chunk;
+			chunk.words.assign(voc.begin() + knownWords, voc.end());
+			chunk.seq = std::move(seq);
+			chunk.points = std::move(points);
+			knownWords = voc.size();
+			seq.clear();
+			points.clear();
+			if (!chunk.seq.empty())
+				sink(std::move(chunk));
+			
+			carry = size - cut;
+			std::copy(buf.begin() + cut, buf.begin() + size, buf.begin());
+			if (last)
+				break;
 		}
 		
-		delete[] buf;
-		return 0;
+		fclose(fish);
+		return empty ? 2 : 0;
+	}
+};
+
+// blocking queue of at most limit items, for handing work between threads
+template <typename T>
+class BoundedQueue
+{
+protected:
+	std::deque<T> pItems;
+	std::size_t pLimit;
+	std::mutex pMutex;
+	std::condition_variable pNotEmpty, pNotFull;
+	bool pClosed = false;
+	
+public:
+	inline explicit BoundedQueue(std::size_t limit): pLimit(std::max<std::size_t>(limit, 1)) {}
+	
+	inline void push(T &&item)
+	{
+		std::unique_lock lock(pMutex);
+		pNotFull.wait(lock, [this] { return pItems.size() < pLimit; });
+		pItems.push_back(std::move(item));
+		pNotEmpty.notify_one();
+	}
+	
+	// false once the queue is closed and drained
+	inline bool pop(T &item)
+	{
+		std::unique_lock lock(pMutex);
+		pNotEmpty.wait(lock, [this] { return pClosed || !pItems.empty(); });
+		if (pItems.empty())
+			return false;
+		item = std::move(pItems.front());
+		pItems.pop_front();
+		pNotFull.notify_one();
+		return true;
+	}
+	
+	inline void close()
+	{
+		std::lock_guard lock(pMutex);
+		pClosed = true;
+		pNotEmpty.notify_all();
 	}
 };
 
 class SpoofGPT: public kpsm2sk::Network
 {
+public:
+	// how the next word is drawn
+	struct Sampling
+	{
+		int topK = 3;            // most probable words to pick from
+		float temperature = 1.f; // below 1 sharpens their weights, above 1 flattens them
+		float backoff = 0.4f;    // weight of an order relative to the one above it
+	};
+	
 protected:
 	Text pTxt;
 	std::mt19937 pRgen;
+	kpsm2sk::Integer pStride = 0; // distance of the input slots in mat[0], more than voc.size()
+	
+	// words of the context, there are patterns of every order up to it. the outputs
+	// are word-major, node word * pOrder + order - 1
+	int pOrder = 3;
+	Sampling pSampling;
 	
 public:
 	inline SpoofGPT() = default;
+	inline explicit SpoofGPT(int order): pOrder(order) {}
 	
-	inline SpoofGPT (const char *filename)
+	inline SpoofGPT (const char *filename, int minCount = 0, std::size_t maxWords = 0, int order = 3):
+		pOrder(order)
 	{
-		if (buildByText(filename) != 0)
+		if (buildByText(filename, minCount, maxWords) != 0)
 			throw std::runtime_error("failed to load file");
 	}
 	
-	inline int buildByText(const char *filename)
+	inline int buildByText(const char *filename, int minCount = 0, std::size_t maxWords = 0)
 	{
 		using namespace kpsm2sk;
 		
-		int res = pTxt.loadFile(filename);
+		int res = pTxt.loadFile(filename, maxWords);
 		if (res != 0)
 			return res;
+		pTxt.sortByFrequency(minCount);
 		
 		Integer netWordSize = pTxt.voc.size() + 1; // +1 for syntax (currently points)
-		std::vector<Integer> netconf {netWordSize * g_inputWords, 0, 0, netWordSize};
+		std::vector<Integer> netconf {netWordSize * pOrder, 0, 0, netWordSize * pOrder};
 		this->buildByConfig(netconf, 0.f, 1.f, 0.f);
+		pStride = netWordSize;
 		
-		mat[2].resize(netWordSize);
-		for (Integer i = 0; i != mat[2].size(); ++i)
+		growOutputs(netWordSize);
+		return 0;
+	}
+	
+	// add output words up to the given count, each with its own pattern-output node per order
+	inline void growOutputs(kpsm2sk::Integer netWordSize)
+	{
+		using namespace kpsm2sk;
+		
+		Integer prev = mat[2].size();
+		mat[2].resize(netWordSize * pOrder);
+		mat[3].resize(netWordSize * pOrder);
+		for (Integer i = prev; i < netWordSize * pOrder; ++i)
 		{
 			mat[2][i].links.push_back(Connection {
 				.k = 0.f, .w = 1.f, .c = 0.f,
 				.addr = NodeAddr {3, i}
 			});
 		}
+	}
+	
+	// move the input nodes to a bigger slot stride, nothing links to them
+	inline void growInputs(kpsm2sk::Integer stride)
+	{
+		using namespace kpsm2sk;
+		
+		std::vector<Node> nodes(stride * pOrder);
+		for (Integer slot = 0; slot != pOrder; ++slot)
+			for (Integer w = 0; w != pStride; ++w)
+				nodes[slot * stride + w] = std::move(mat[0][slot * pStride + w]);
+		mat[0] = std::move(nodes);
+		pStride = stride;
+	}
+	
+	// renumber the words of a built network, remap holds the new id of every old word
+	// and several words may share one. netWordSize is the new count of words + 1
+	inline void remapWords(std::vector<int> const &remap, kpsm2sk::Integer netWordSize)
+	{
+		using namespace kpsm2sk;
+		
+		// the syntax node stays last
+		const auto newId = [&](Integer w) {
+			return w < remap.size() ? remap[w] : netWordSize - 1;
+		};
+		
+		std::vector<Node> inputs(netWordSize * pOrder);
+		std::vector<bool> merged(inputs.size());
+		for (Integer slot = 0; slot != pOrder; ++slot)
+		{
+			for (Integer w = 0; w != pStride; ++w)
+			{
+				auto &src = mat[0][slot * pStride + w].links;
+				if (src.empty())
+					continue;
+				
+				Integer dst = slot * netWordSize + newId(w);
+				auto &links = inputs[dst].links;
+				if (!links.empty())
+					merged[dst] = true;
+				links.insert(links.end(), src.begin(), src.end());
+			}
+		}
+		// merged words link patterns in corpus order, as if built with the new ids
+		for (Integer i = 0; i != inputs.size(); ++i)
+			if (merged[i])
+				std::sort(inputs[i].links.begin(), inputs[i].links.end(), [](Connection const &a, Connection const &b) {
+					return a.addr.node < b.addr.node;
+				});
+		mat[0] = std::move(inputs);
+		pStride = netWordSize;
+		
+		for (Node &node: mat[1])
+			for (auto &lnk: node.links)
+				lnk.addr.node = newId(lnk.addr.node / pOrder) * pOrder + lnk.addr.node % pOrder;
+		
+		mat[2].clear();
+		mat[3].clear();
+		growOutputs(netWordSize);
+	}
+	
+	// continue the text, patterns are added for the new positions. the ids of the chunk
+	// have to continue the vocabulary
+	inline void appendChunk(Text::Chunk &&chunk, unsigned threads = 0)
+	{
+		using namespace kpsm2sk;
+		
+		int built = std::max(0, (int)pTxt.seq.size() - pOrder - 1);
+		
+		for (auto &w: chunk.words)
+			pTxt.voc.push_back(std::move(w));
+		pTxt.seq.insert(pTxt.seq.end(), chunk.seq.begin(), chunk.seq.end());
+		pTxt.points.insert(pTxt.points.end(), chunk.points.begin(), chunk.points.end());
+		
+		Integer netWordSize = pTxt.voc.size() + 1;
+		if (netWordSize > pStride)
+			growInputs(std::max(pStride * 2, netWordSize));
+		growOutputs(netWordSize);
+		
+		int end = (int)pTxt.seq.size() - pOrder - 1;
+		if (end > built)
+			addWordPatterns(built, end, 0.7f, threads);
+	}
+	
+	// tokenize the file on another thread and build the patterns of every chunk as it comes,
+	// the input layer grows with the vocabulary. the result is the same as of buildByText
+	// followed by addWordPatterns over the whole text
+	inline int buildByStream (
+		const char *filename,
+		int minCount = 0,
+		unsigned threads = 0,
+		std::size_t chunkBytes = 1 << 20,
+		std::size_t queueChunks = 4
+	) {
+		using namespace kpsm2sk;
 		
+		pTxt = Text();
+		this->buildByConfig({0, 0, 0, 0});
+		pStride = 0;
+		
+		BoundedQueue<Text::Chunk> queue(queueChunks);
+		Text reader;
+		int res = 0;
+		std::thread readerThread([&] {
+			res = reader.streamFile(filename, chunkBytes, [&queue](Text::Chunk &&chunk) {
+				queue.push(std::move(chunk));
+			});
+			queue.close();
+		});
+		
+		Text::Chunk chunk;
+		while (queue.pop(chunk))
+			appendChunk(std::move(chunk), threads);
+		readerThread.join();
+		if (res != 0)
+			return res;
+		
+		pTxt.index = std::move(reader.index);
+		pTxt.fileBytes = reader.fileBytes;
+		pTxt.loadedBytes = reader.loadedBytes;
+		
+		auto remap = pTxt.sortByFrequency(minCount);
+		remapWords(remap, pTxt.voc.size() + 1);
 		return 0;
 	}
 	
@@ -173,126 +566,996 @@ public:
 		}
 	}
 	
+	// the patterns of every order ending at the same word, an order takes the last
+	// input slots
 	inline void addWordPattern(int seqbeg, float learnMul = 0.7f)
 	{
 		// @todo consider points
 		using namespace kpsm2sk;
-		Integer netWordSize = pTxt.voc.size() + 1;
-		Integer predictWordIndex = pTxt.seq[seqbeg + g_inputWords];
+		Integer predictWordIndex = pTxt.seq[seqbeg + pOrder];
 		
-		std::vector<Integer> inputs(g_inputWords);
-		for (Integer i = 0; i != g_inputWords; ++i)
+		for (Integer order = 1; order <= pOrder; ++order)
 		{
-			Integer vocabWordIndex = pTxt.seq[seqbeg + i];
-			inputs[i] = i * netWordSize + vocabWordIndex;
+			std::vector<Integer> inputs;
+			for (Integer i = pOrder - order; i != pOrder; ++i)
+			{
+				Integer vocabWordIndex = pTxt.seq[seqbeg + i];
+				inputs.push_back(i * pStride + vocabWordIndex);
+			}
+			addLogicPattern(inputs, predictWordIndex * pOrder + order - 1);
 		}
-		addLogicPattern(inputs, predictWordIndex);
 	}
 	
-	inline void loadInput(std::deque<int> const &q)
+	// more build threads than this are not used
+	static constexpr unsigned maxBuildThreads = 256;
+	
+	// same as calling addWordPattern for every position in [seqbeg, seqend) in order,
+	// but the patterns are generated on several threads and then merged
+	inline void addWordPatterns(int seqbeg, int seqend, float learnMul = 0.7f, unsigned threads = 0)
 	{
 		using namespace kpsm2sk;
 		
-		assert(q.size() > 0 && q.size() <= g_inputWords);
-		int iter = g_inputWords - q.size();
+		if (threads == 0)
+			threads = std::max(1u, std::thread::hardware_concurrency());
 		
-		Integer netWordSize = pTxt.voc.size() + 1;
+		const int count = seqend - seqbeg;
+		if (count <= 0)
+			return;
+		// every thread keeps a bucket for every other, so their number is kept small
+		threads = std::min({threads, maxBuildThreads, (unsigned)count});
+		if (threads < 2)
+		{
+			for (int i = seqbeg; i != seqend; ++i)
+				addWordPattern(i, learnMul);
+			return;
+		}
+		
+		const Integer inputNodes = mat[0].size();
+		const Integer patternBase = mat[1].size();
 		
-		// @todo optimize
-		for (auto &node: mat[0])
-			node.s = 0.f;
+		// one pattern node per position and order, so the mat[1] index of every pattern is known upfront
+		mat[1].resize(patternBase + (Integer)count * pOrder);
 		
+		// input node ranges, each merged by its own thread
+		const auto ownerOf = [&](Integer inputNode) {
+			return (unsigned)((int64_t)inputNode * threads / inputNodes);
+		};
+		
+		// buckets[t][u] holds (input node, pattern node) pairs generated by thread t for owner u,
+		// in corpus order
+		std::vector<std::vector<std::vector<std::pair<Integer, Integer>>>> buckets(
+			threads, std::vector<std::vector<std::pair<Integer, Integer>>>(threads)
+		);
+		
+		const auto generate = [&](unsigned t) {
+			int beg = seqbeg + (int)((int64_t)count * t / threads);
+			int end = seqbeg + (int)((int64_t)count * (t + 1) / threads);
+			
+			for (int pos = beg; pos != end; ++pos)
+			{
+				Integer predictWordIndex = pTxt.seq[pos + pOrder];
+				
+				for (Integer order = 1; order <= pOrder; ++order)
+				{
+					Integer pattern = patternBase + (pos - seqbeg) * pOrder + order - 1;
+					mat[1][pattern].links.push_back(Connection {
+						.k = 0.f, .w = 1.f, .c = 0.f,
+						.addr = {2, predictWordIndex * pOrder + order - 1}
+					});
+					
+					for (Integer i = pOrder - order; i != pOrder; ++i)
+					{
+						Integer input = i * pStride + pTxt.seq[pos + i];
+						buckets[t][ownerOf(input)].emplace_back(input, pattern);
+					}
+				}
+			}
+		};
+		
+		const auto merge = [&](unsigned u) {
+			// visiting the buckets in thread order keeps links sorted by corpus position
+			for (unsigned t = 0; t != threads; ++t)
+				for (auto const &[input, pattern]: buckets[t][u])
+					mat[0][input].links.push_back(Connection {
+						.k = 1.f, .w = 1.f, .c = 0.f,
+						.addr = {1, pattern}
+					});
+		};
+		
+		const auto runAll = [threads](auto const &job) {
+			std::vector<std::thread> workers;
+			workers.reserve(threads - 1);
+			for (unsigned t = 1; t < threads; ++t)
+				workers.emplace_back(job, t);
+			job(0);
+			for (auto &w: workers)
+				w.join();
+		};
+		
+		runAll(generate);
+		runAll(merge);
+	}
+	
+	inline void loadInput(kpsm2sk::ActivationState &st, std::deque<int> const &q) const
+	{
+		using namespace kpsm2sk;
+		
+		assert(q.size() > 0 && q.size() <= pOrder);
+		int iter = pOrder - q.size();
+		
+		st.clearInput();
 		for (int n: q)
 		{
 			// @todo consider points
-			mat[0][iter * netWordSize + n].s = 1.f;
+			// words learned after the model (see SpoofVersion) have no input here
+			if (n < pStride)
+				st.setSignal({0, iter * pStride + n}, 1.f);
 			++iter;
 		}
 	}
 	
-	// pick randomly one of three most probable words
-	inline int readOutput()
+	struct Candidate
+	{
+		float s;
+		int word;
+	};
+	// most probable words, by descending signal
+	using TopWords = std::vector<Candidate>;
+	
+	static inline TopWords noCandidates(int k) {
+		return TopWords(k, Candidate {-1.f, -1});
+	}
+	
+	// an equal signal doesn't displace the word already there, so the lower words win
+	// when candidates are offered in ascending order
+	static inline void offer(TopWords &top, Candidate cand)
+	{
+		if (!(cand.s > top.back().s))
+			return;
+		std::size_t i = top.size() - 1;
+		for (; i > 0 && cand.s > top[i - 1].s; --i)
+			top[i] = top[i - 1];
+		top[i] = cand;
+	}
+	
+	// all orders come out of one pass, the highest order predicting the word decides and
+	// every order below the top one weighs backoff times less (stupid backoff).
+	// signal(n) reads output node n, word is counted from the first output
+	template <typename Signal>
+	inline float score(int word, Signal const &signal) const
+	{
+		float weight = 1.f;
+		for (int order = pOrder; order > 0; --order, weight *= pSampling.backoff)
+		{
+			float s = signal(word * pOrder + order - 1);
+			if (s > 0.f)
+				return s * weight;
+		}
+		return 0.f;
+	}
+	
+	// most probable words of the outputs of [0, wordEnd - wordBeg) standing for [wordBeg, wordEnd)
+	inline TopWords collectTop(kpsm2sk::ActivationState const &st, int wordBeg, int wordEnd) const
+	{
+		TopWords top = noCandidates(pSampling.topK);
+		const kpsm2sk::Integer outLayer = st.layers.size() - 1;
+		const auto signal = [&](kpsm2sk::Integer node) {
+			return st.signal({outLayer, node});
+		};
+		for (int i = wordBeg; i != wordEnd; ++i)
+			offer(top, {score(i - wordBeg, signal), i});
+		return top;
+	}
+	
+	// pick randomly one of the most probable words, by their signals
+	inline int sample(TopWords const &top, std::mt19937 &rgen) const
+	{
+		const auto weight = [this](float s) {
+			return pSampling.temperature == 1.f ? s : std::pow(s, 1.f / pSampling.temperature);
+		};
+		
+		float sum = 0.f;
+		for (auto const &cand: top)
+		{
+			if (cand.s == -1.f)
+				return rgen() % pTxt.voc.size();
+			sum += weight(cand.s);
+		}
+		float probabMul = 1.f / sum;
+		
+		float randNum = rgen() * (1.f / (float)0xffffffff);
+		float probab = 0.f;
+		for (std::size_t i = 0; i + 1 < top.size(); ++i)
+		{
+			probab += weight(top[i].s) * probabMul;
+			if (!(randNum > probab))
+				return top[i].word;
+		}
+		return top.back().word;
+	}
+	
+	inline int readOutput(kpsm2sk::ActivationState const &st, std::mt19937 &rgen) const {
+		return sample(collectTop(st, 0, pTxt.voc.size()), rgen);
+	}
+	
+	// the same for the logic engine, every lane holds its own context
+	using Logic = kpsm2sk::LogicNetwork<>;
+	
+	inline void loadInput(Logic const &logic, Logic::State &st, std::deque<int> const &q, kpsm2sk::Integer lane = 0) const
+	{
+		assert(q.size() > 0 && q.size() <= pOrder);
+		int iter = pOrder - q.size();
+		
+		for (kpsm2sk::Integer i = 0; i != logic.layerBeg[1]; ++i)
+			logic.setInput(st, i, lane, false);
+		for (int n: q)
+			logic.setInput(st, iter++ * pStride + n, lane);
+	}
+	
+	inline int readOutput(Logic const &logic, Logic::State const &st, std::mt19937 &rgen, kpsm2sk::Integer lane = 0) const
+	{
+		TopWords top = noCandidates(pSampling.topK);
+		const kpsm2sk::Integer outLayer = logic.layerBeg.size() - 2;
+		const auto signal = [&](kpsm2sk::Integer node) {
+			return logic.signal(st, {outLayer, node}, lane) ? 1.f : 0.f;
+		};
+		for (int i = 0; i != pTxt.voc.size(); ++i)
+			offer(top, {score(i, signal), i});
+		return sample(top, rgen);
+	}
+	
+	// the same on the own state of the network
+	inline void loadInput(std::deque<int> const &q)
+	{
+		state.fit(*this);
+		loadInput(state, q);
+	}
+	inline int readOutput() {
+		return readOutput(state, pRgen);
+	}
+	
+	inline Text const &getText() const { return pTxt; }
+	inline int getOrder() const { return pOrder; }
+	inline Sampling const &getSampling() const { return pSampling; }
+	
+	inline void setSampling(Sampling const &sampling)
+	{
+		pSampling = sampling;
+		pSampling.topK = std::max(1, pSampling.topK);
+	}
+	
+	struct Projection
+	{
+		std::size_t words;
+		std::size_t vocabulary;
+		kpsm2sk::MemoryUsage net;
+		TextMemory text;
+	};
+	
+	// estimate the footprint of the whole file from a network built of its prefix,
+	// the vocabulary is extrapolated by Heaps' law fitted to the sample
+	inline Projection projectMemoryUsage() const
 	{
 		using namespace kpsm2sk;
 		
-		float probab0 = -1.f, probab1 = -1.f, probab2 = -1.f;
-		int probabWord0, probabWord1, probabWord2;
-		 
-		for (Integer i = 0; i != pTxt.voc.size(); ++i)
+		Projection res {pTxt.seq.size(), pTxt.voc.size(), memoryUsage(), pTxt.memoryUsage()};
+		if (pTxt.loadedBytes == 0 || pTxt.loadedBytes >= pTxt.fileBytes || pTxt.seq.size() < 2)
+			return res;
+		
+		const double textScale = (double)pTxt.fileBytes / pTxt.loadedBytes;
+		
+		const std::size_t half = pTxt.seq.size() / 2;
+		std::vector<bool> seen(pTxt.voc.size());
+		for (std::size_t i = 0; i != half; ++i)
+			seen[pTxt.seq[i]] = true;
+		const double halfVoc = std::count(seen.begin(), seen.end(), true);
+		const double beta = std::log(pTxt.voc.size() / halfVoc) / std::log((double)pTxt.seq.size() / half);
+		const double vocScale = std::pow(textScale, beta);
+		
+		res.words = pTxt.seq.size() * textScale;
+		res.vocabulary = pTxt.voc.size() * vocScale;
+		
+		const double netVocScale = (res.vocabulary + 1.0) / (pTxt.voc.size() + 1.0);
+		const auto scale = [](LayerMemory &l, double nodeScale, double linkScale) {
+			l.nodes *= nodeScale;
+			l.nodeBytes *= nodeScale;
+			l.overhead *= nodeScale;
+			l.links *= linkScale;
+			l.implicitLinks *= linkScale;
+			l.linkBytes *= linkScale;
+			l.linkCapacity *= linkScale;
+		};
+		// input and output layers grow with the vocabulary, patterns with the text
+		scale(res.net.layers[0], netVocScale, textScale);
+		scale(res.net.layers[1], textScale, textScale);
+		scale(res.net.layers[2], netVocScale, netVocScale);
+		scale(res.net.layers[3], netVocScale, netVocScale);
+		
+		res.text.words = res.vocabulary;
+		res.text.vocBytes *= vocScale;
+		res.text.indexBytes *= vocScale;
+		res.text.seqBytes *= textScale;
+		res.text.pointsBytes *= textScale;
+		res.text.overhead *= vocScale;
+		
+		return res;
+	}
+};
+
+// the model split by ranges of output words, each shard is evaluated by its own worker.
+// a step broadcasts the context to all shards and merges their candidates
+class SpoofShards
+{
+protected:
+	struct Shard
+	{
+		kpsm2sk::Network net;
+		kpsm2sk::ActivationState st;
+		int wordBeg, wordEnd;
+		SpoofGPT::TopWords top;
+	};
+	
+	SpoofGPT const &pModel;
+	std::vector<Shard> pShards;
+	std::vector<std::thread> pWorkers;
+	
+	std::mutex pMutex;
+	std::condition_variable pWake, pDone;
+	std::deque<int> const *pContext = nullptr;
+	unsigned pGeneration = 0;
+	unsigned pPending = 0;
+	bool pStop = false;
+	
+	inline void work(Shard &shard)
+	{
+		unsigned seen = 0;
+		while (true)
 		{
-			auto const &node = mat.back()[i];
-			if (node.s > probab0) {
-				probab0 = node.s;
-				probabWord0 = i;
+			{
+				std::unique_lock lock(pMutex);
+				pWake.wait(lock, [&] { return pStop || pGeneration != seen; });
+				if (pStop)
+					return;
+				seen = pGeneration;
 			}
-			else if (node.s > probab1) {
-				probab1 = node.s;
-				probabWord1 = i;
+			
+			pModel.loadInput(shard.st, *pContext);
+			shard.net.run(shard.st);
+			shard.top = pModel.collectTop(shard.st, shard.wordBeg, shard.wordEnd);
+			
+			std::lock_guard lock(pMutex);
+			if (--pPending == 0)
+				pDone.notify_one();
+		}
+	}
+	
+public:
+	// model has to outlive the shards, its own topology isn't needed afterwards
+	inline SpoofShards(SpoofGPT const &model, unsigned shards): pModel(model)
+	{
+		const int words = model.getText().voc.size();
+		shards = std::max(1u, std::min<unsigned>(shards, words));
+		
+		pShards.resize(shards);
+		for (unsigned i = 0; i != shards; ++i)
+		{
+			Shard &shard = pShards[i];
+			shard.wordBeg = (int64_t)words * i / shards;
+			shard.wordEnd = (int64_t)words * (i + 1) / shards;
+			shard.net = model.extractOutputs(shard.wordBeg * model.getOrder(), shard.wordEnd * model.getOrder());
+			shard.st.fit(shard.net);
+		}
+		for (Shard &shard: pShards)
+			pWorkers.emplace_back(&SpoofShards::work, this, std::ref(shard));
+	}
+	
+	inline ~SpoofShards()
+	{
+		{
+			std::lock_guard lock(pMutex);
+			pStop = true;
+		}
+		pWake.notify_all();
+		for (auto &w: pWorkers)
+			w.join();
+	}
+	
+	inline int readOutput(std::deque<int> const &q, std::mt19937 &rgen)
+	{
+		{
+			std::unique_lock lock(pMutex);
+			pContext = &q;
+			pPending = pShards.size();
+			++pGeneration;
+			pWake.notify_all();
+			pDone.wait(lock, [this] { return pPending == 0; });
+		}
+		
+		// shards cover ascending word ranges and the scores don't depend on the other
+		// shards, so the result is the one of SpoofGPT::readOutput
+		auto top = SpoofGPT::noCandidates(pModel.getSampling().topK);
+		for (Shard const &shard: pShards)
+			for (auto const &cand: shard.top)
+				SpoofGPT::offer(top, cand);
+		return pModel.sample(top, rgen);
+	}
+	
+	inline kpsm2sk::MemoryUsage memoryUsage() const
+	{
+		kpsm2sk::MemoryUsage res;
+		for (Shard const &shard: pShards)
+		{
+			auto part = shard.net.memoryUsage();
+			res.layers.resize(part.layers.size());
+			for (std::size_t i = 0; i != part.layers.size(); ++i)
+			{
+				auto &l = res.layers[i];
+				auto const &p = part.layers[i];
+				l.nodes += p.nodes;
+				l.links += p.links;
+				l.implicitLinks += p.implicitLinks;
+				l.nodeBytes += p.nodeBytes;
+				l.linkBytes += p.linkBytes;
+				l.linkCapacity += p.linkCapacity;
+				l.overhead += p.overhead;
 			}
-			else if (node.s > probab2) {
-				probab2 = node.s;
-				probabWord2 = i;
+		}
+		return res;
+	}
+};
+
+// patterns learned after the model was built, kept apart so versions can share them.
+// the net has the inputs the patterns use, the patterns and the pattern-output nodes they
+// reach, the first and the last numbered compactly. a pattern-output node is 1 unless one of
+// its patterns is on, which multiplies into the same node of the model
+struct SpoofSegment
+{
+	kpsm2sk::Network net;
+	std::vector<int64_t> inputs;           // key of every input, word * order + slot, ascending
+	std::vector<kpsm2sk::Integer> outputs; // pattern-output node of the model of every output
+	std::vector<std::string> words;        // vocabulary first seen in its text, continuing the ids
+	
+	inline kpsm2sk::Integer patterns() const {
+		return net.mat[1].size();
+	}
+	
+	inline void loadInput(kpsm2sk::ActivationState &st, std::deque<int> const &q, int order) const
+	{
+		st.clearInput();
+		int slot = order - q.size();
+		for (int word: q)
+		{
+			int64_t key = (int64_t)word * order + slot++;
+			auto iter = std::lower_bound(inputs.begin(), inputs.end(), key);
+			if (iter != inputs.end() && *iter == key)
+				st.setSignal({0, (kpsm2sk::Integer)(iter - inputs.begin())}, 1.f);
+		}
+	}
+};
+
+// gathers the patterns of a segment in corpus order, the inputs are sorted by finish
+class SpoofSegmentBuilder
+{
+protected:
+	std::unordered_map<int64_t, kpsm2sk::Integer> pInput;
+	std::unordered_map<kpsm2sk::Integer, kpsm2sk::Integer> pOutput;
+	
+public:
+	SpoofSegment seg;
+	
+	inline SpoofSegmentBuilder() {
+		seg.net.mat.resize(3);
+	}
+	
+	inline void add(std::vector<int64_t> const &keys, kpsm2sk::Integer output)
+	{
+		using namespace kpsm2sk;
+		auto &mat = seg.net.mat;
+		
+		auto [out, newOut] = pOutput.try_emplace(output, (Integer)mat[2].size());
+		if (newOut)
+		{
+			mat[2].emplace_back();
+			seg.outputs.push_back(output);
+		}
+		
+		const Integer pattern = mat[1].size();
+		mat[1].push_back(Node {.links = {{.k = 0.f, .w = 1.f, .c = 0.f, .addr = {2, out->second}}}});
+		for (int64_t key: keys)
+		{
+			auto [in, newIn] = pInput.try_emplace(key, (Integer)mat[0].size());
+			if (newIn)
+			{
+				mat[0].emplace_back();
+				seg.inputs.push_back(key);
 			}
+			mat[0][in->second].links.push_back(Connection {.k = 1.f, .w = 1.f, .c = 0.f, .addr = {1, pattern}});
+		}
+	}
+	
+	inline SpoofSegment finish()
+	{
+		using namespace kpsm2sk;
+		
+		// nothing links to the inputs, so they are just put in key order
+		std::vector<Integer> order(seg.inputs.size());
+		for (Integer i = 0; i != order.size(); ++i)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), [this](Integer a, Integer b) {
+			return seg.inputs[a] < seg.inputs[b];
+		});
+		std::vector<Node> nodes(order.size());
+		std::vector<int64_t> keys(order.size());
+		for (Integer i = 0; i != order.size(); ++i)
+		{
+			nodes[i] = std::move(seg.net.mat[0][order[i]]);
+			keys[i] = seg.inputs[order[i]];
+		}
+		seg.net.mat[0] = std::move(nodes);
+		seg.inputs = std::move(keys);
+		
+		pInput.clear();
+		pOutput.clear();
+		SpoofSegment res = std::move(seg);
+		seg = SpoofSegment();
+		seg.net.mat.resize(3);
+		return res;
+	}
+	
+	// the patterns of a followed by the ones of b, as if learned in one segment
+	static inline SpoofSegment merge(SpoofSegment const &a, SpoofSegment const &b)
+	{
+		using namespace kpsm2sk;
+		
+		SpoofSegmentBuilder builder;
+		std::vector<std::vector<int64_t>> keys;
+		for (SpoofSegment const *seg: {&a, &b})
+		{
+			keys.assign(seg->patterns(), {});
+			for (Integer i = 0; i != seg->inputs.size(); ++i)
+				for (auto const &lnk: seg->net.mat[0][i].links)
+					keys[lnk.addr.node].push_back(seg->inputs[i]);
+			for (Integer p = 0; p != seg->patterns(); ++p)
+				builder.add(keys[p], seg->outputs[seg->net.mat[1][p].links[0].addr.node]);
 		}
+		SpoofSegment res = builder.finish();
+		res.words = a.words;
+		res.words.insert(res.words.end(), b.words.begin(), b.words.end());
+		return res;
+	}
+};
+
+// a served version of the model: the model as built and the segments learned since. the
+// versions share both, a new one only adds a segment (or a merge of the last ones)
+class SpoofVersion
+{
+public:
+	std::shared_ptr<SpoofGPT const> base;
+	std::vector<std::shared_ptr<SpoofSegment const>> segments;
+	
+	// signals of one reader
+	struct State
+	{
+		kpsm2sk::ActivationState base;
+		std::vector<kpsm2sk::ActivationState> segments;
+		std::vector<float> miss; // pattern-output nodes of all parts multiplied
+	};
+	
+	inline explicit SpoofVersion(std::shared_ptr<SpoofGPT const> model): base(std::move(model)) {}
+	
+	inline int getOrder() const {
+		return base->getOrder();
+	}
+	inline int words() const
+	{
+		std::size_t n = base->getText().voc.size();
+		for (auto const &seg: segments)
+			n += seg->words.size();
+		return n;
+	}
+	inline std::string const &word(int id) const
+	{
+		auto const &voc = base->getText().voc;
+		if (id < voc.size())
+			return voc[id];
+		id -= voc.size();
+		for (auto const &seg: segments)
+		{
+			if (id < seg->words.size())
+				return seg->words[id];
+			id -= seg->words.size();
+		}
+		throw std::out_of_range("word id");
+	}
+	
+	inline void run(State &st, std::deque<int> const &q) const
+	{
+		using namespace kpsm2sk;
+		
+		st.base.fit(*base);
+		base->loadInput(st.base, q);
+		base->run(st.base);
+		if (segments.empty())
+			return;
+		
+		const int order = getOrder();
+		st.miss.assign((std::size_t)words() * order, 1.f);
+		for (Integer i = 0; i != base->mat[2].size(); ++i)
+			st.miss[i] = st.base.signal({2, i});
+		
+		st.segments.resize(segments.size());
+		for (std::size_t i = 0; i != segments.size(); ++i)
+		{
+			SpoofSegment const &seg = *segments[i];
+			ActivationState &sst = st.segments[i];
+			sst.fit(seg.net);
+			seg.loadInput(sst, q, order);
+			seg.net.run(sst);
+			for (Integer o = 0; o != seg.outputs.size(); ++o)
+				st.miss[seg.outputs[o]] *= sst.signal({2, o});
+		}
+	}
+	
+	// the output nodes of the model are 1 - their pattern-output node, for the 0/1 signals of
+	// the text model the result is the one of a model with all the patterns
+	inline int readOutput(State const &st, std::mt19937 &rgen) const
+	{
+		if (segments.empty())
+			return base->readOutput(st.base, rgen);
 		
-		if (probab0 == -1.f || probab1 == -1.f || probab2 == -1.f)
-			return pRgen() % pTxt.voc.size();
+		auto top = SpoofGPT::noCandidates(base->getSampling().topK);
+		const auto signal = [&](kpsm2sk::Integer node) {
+			return 1.f - st.miss[node];
+		};
+		const int count = words();
+		for (int i = 0; i != count; ++i)
+			SpoofGPT::offer(top, {base->score(i, signal), i});
+		return base->sample(top, rgen);
+	}
+};
+
+// keep learning the text of a file while the model is being served. the patterns of every
+// chunksPerVersion chunks go to a new segment published with a new version, the model and the
+// earlier segments are shared. a segment at least as big as the one before is merged into it,
+// so there are O(log) segments and a pattern is copied O(log) times
+inline int ingestFile (
+	kpsm2sk::Versioned<SpoofVersion> &versions,
+	const char *filename,
+	std::size_t chunkBytes,
+	int chunksPerVersion
+) {
+	SpoofVersion const &start = versions.current();
+	Text const &text = start.base->getText();
+	const int order = start.getOrder();
+	
+	// tokenize with the ids of the model, new words continue them
+	Text reader;
+	reader.voc = text.voc;
+	for (auto const &seg: start.segments)
+		reader.voc.insert(reader.voc.end(), seg->words.begin(), seg->words.end());
+	reader.index = text.index;
+	for (int i = text.voc.size(); i != reader.voc.size(); ++i)
+		reader.index.emplace(reader.voc[i], i);
+	
+	// the words not yet predicted, a pattern is made once a word follows the one it predicts
+	// (as appendChunk does), the text of the model leaves its last order + 1 words
+	std::deque<int> window(text.seq.end() - std::min<std::size_t>(text.seq.size(), order + 1), text.seq.end());
+	
+	SpoofSegmentBuilder builder;
+	std::vector<int64_t> keys;
+	int pending = 0;
+	const auto publish = [&] {
+		auto next = std::make_unique<SpoofVersion>(versions.current());
+		next->segments.push_back(std::make_shared<SpoofSegment const>(builder.finish()));
+		auto &segs = next->segments;
+		while (segs.size() >= 2 && segs.back()->patterns() >= segs[segs.size() - 2]->patterns())
+		{
+			auto merged = std::make_shared<SpoofSegment const>(SpoofSegmentBuilder::merge(*segs[segs.size() - 2], *segs.back()));
+			segs.pop_back();
+			segs.back() = std::move(merged);
+		}
+		versions.publish(std::move(next));
+		pending = 0;
+	};
+	
+	int res = reader.streamFile(filename, chunkBytes, [&](Text::Chunk &&chunk) {
+		for (auto &w: chunk.words)
+			builder.seg.words.push_back(std::move(w));
+		window.insert(window.end(), chunk.seq.begin(), chunk.seq.end());
 		
-		float probabMul = 1.f / (probab0 + probab1 + probab2);
-		probab0 *= probabMul;
-		probab1 *= probabMul;
+		for (; window.size() >= order + 2; window.pop_front())
+		{
+			// the patterns of every order, as addWordPattern
+			kpsm2sk::Integer predictWordIndex = window[order];
+			for (int o = 1; o <= order; ++o)
+			{
+				keys.clear();
+				for (int i = order - o; i != order; ++i)
+					keys.push_back((int64_t)window[i] * order + i);
+				builder.add(keys, predictWordIndex * order + o - 1);
+			}
+		}
+		if (++pending >= chunksPerVersion)
+			publish();
+	});
+	if (pending != 0)
+		publish();
+	
+	// the retired versions are freed here rather than by the readers, which move on by the step
+	while (versions.reclaim() != 0)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return res;
+}
+
+// usage: prog [flags] [text file] [learnMul] [context words] [build threads]
+//   the model predicts from every context order up to [context words], backing off to lower ones
+//   -u <count>  words seen less than <count> times share one "<unk>" word
+//   -m          print the memory breakdown after build
+//   -p <words>  build of the first <words> words only, print the projected footprint of the whole file and exit
+//   -o <order>  reorder the pattern nodes by their sources (faster steps) or targets, none by default
+//   -b <steps>  time <steps> generation steps without output and pacing, then exit
+//   -s <shards> split the model by output words into <shards> parts evaluated in parallel
+//   -e <engine> float (default) or logic, the bit-parallel engine for 0/1 networks (not sharded)
+//   -i <file>   learn the text of the file (or pipe) while generating, float engine without shards
+//   -f <file>   read the settings from a cecfg file (see Options::load), later arguments override it
+struct Options
+{
+	std::string txtFile = "input.txt";
+	float learnMul = 0.7f;
+	int order = 3; // context words
+	int buildThreads = 0;
+	bool printMemory = false;
+	std::size_t projectWords = 0;
+	int minCount = 0;
+	std::string nodeOrder = "none";
+	int benchSteps = 0;
+	int shards = 1;
+	int chunkBytes = 1 << 20; // read ahead by the loading pipeline
+	int queueChunks = 4;
+	std::string engine = "float";
+	std::string ingestFile;
+	int ingestChunks = 1; // chunks learned per published version
+	int pacing = 300;     // ms between printed words
+	SpoofGPT::Sampling sampling;
+	
+	// the settings present in the file replace the current ones, for example
+	//   s: text = input.txt
+	//   i: order = 3
+	//   i: buildThreads = 8
+	//   i: chunkBytes = 4194304
+	//   s: engine = logic
+	//   i: topK = 5
+	//   f: temperature = 0.8
+	//   i: pacing = 100
+	// the names are the ones of the fields, sampling ones without the prefix
+	inline int load(const char *filename)
+	{
+		cecfg::Loader cfg;
+		int res = cfg.fromFile(filename);
+		if (res != 0)
+			return res;
 		
-		float randNum = pRgen() * (1.f / (float)0xffffffff);
-		if (randNum > probab0 + probab1)
-			return probabWord2;
-		else if (randNum > probab0)
-			return probabWord1;
-		return probabWord0;
+		// nothing is taken from a file with a setting of the wrong type,
+		// the ranges are checked by validate once the arguments are applied too
+		Options next = *this;
+		bool valid = true;
+		const auto get = [&](const char *name, auto &field) {
+			if (cfg[name] && !cfg.getOption(name, field))
+				valid = false;
+		};
+		get("text", next.txtFile);
+		get("learnMul", next.learnMul);
+		get("order", next.order);
+		get("buildThreads", next.buildThreads);
+		get("minCount", next.minCount);
+		get("nodeOrder", next.nodeOrder);
+		get("shards", next.shards);
+		get("chunkBytes", next.chunkBytes);
+		get("queueChunks", next.queueChunks);
+		get("engine", next.engine);
+		get("ingest", next.ingestFile);
+		get("ingestChunks", next.ingestChunks);
+		get("pacing", next.pacing);
+		get("topK", next.sampling.topK);
+		get("temperature", next.sampling.temperature);
+		get("backoff", next.sampling.backoff);
+		
+		if (!valid)
+			return 2; // the syntax error code of cecfg
+		*this = std::move(next);
+		return 0;
+	}
+	
+	// the settings are in range, whether from a file or the arguments
+	inline bool validate() const
+	{
+		return order >= 1 && buildThreads >= 0 && minCount >= 0 && benchSteps >= 0
+			&& shards >= 1 && chunkBytes >= 1 && queueChunks >= 1 && ingestChunks >= 1 && pacing >= 0
+			&& sampling.topK >= 1 && sampling.temperature > 0.f && sampling.backoff >= 0.f;
 	}
 	
-	inline Text const &getText() { return pTxt; }
+	static inline Options parse(int argc, char **argv)
+	{
+		Options opt;
+		int pos = 0;
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if (arg == "-m")
+				opt.printMemory = true;
+			else if (arg == "-u" && i + 1 < argc)
+				opt.minCount = std::atoi(argv[++i]);
+			else if (arg == "-p" && i + 1 < argc)
+				opt.projectWords = std::atoll(argv[++i]);
+			else if (arg == "-o" && i + 1 < argc)
+				opt.nodeOrder = argv[++i];
+			else if (arg == "-b" && i + 1 < argc)
+				opt.benchSteps = std::atoi(argv[++i]);
+			else if (arg == "-s" && i + 1 < argc)
+				opt.shards = std::atoi(argv[++i]);
+			else if (arg == "-e" && i + 1 < argc)
+				opt.engine = argv[++i];
+			else if (arg == "-i" && i + 1 < argc)
+				opt.ingestFile = argv[++i];
+			else if (arg == "-f" && i + 1 < argc)
+			{
+				if (opt.load(argv[++i]) != 0)
+					throw std::runtime_error("failed to load settings");
+			}
+			else switch (pos++)
+			{
+			case 0: opt.txtFile = argv[i]; break;
+			case 1: opt.learnMul = std::atof(argv[i]); break;
+			case 2: opt.order = std::atoi(argv[i]); break;
+			case 3: opt.buildThreads = std::atoi(argv[i]); break;
+			}
+		}
+		if (!opt.validate())
+			throw std::runtime_error("settings out of range");
+		return opt;
+	}
 };
 
 int main(int argc, char** argv)
 {
 	using namespace kpsm2sk;
 	
-	const char *txtFile = argc > 1 ? argv[1] : "input.txt";
-	SpoofGPT theNet(txtFile);
+	Options opt = Options::parse(argc, argv);
+	auto theNetPtr = std::make_unique<SpoofGPT>(opt.order);
+	SpoofGPT &theNet = *theNetPtr;
+	theNet.setSampling(opt.sampling);
+	if (opt.projectWords != 0)
+	{
+		if (theNet.buildByText(opt.txtFile.c_str(), opt.minCount, opt.projectWords) != 0)
+			throw std::runtime_error("failed to load file");
+		theNet.addWordPatterns(0, (int)theNet.getText().seq.size() - opt.order - 1, opt.learnMul, opt.buildThreads);
+	}
+	else if (theNet.buildByStream(opt.txtFile.c_str(), opt.minCount, opt.buildThreads, opt.chunkBytes, opt.queueChunks) != 0)
+		throw std::runtime_error("failed to load file");
 	
-	float learnMul = argc > 2 ? std::atof(argv[2]) : 0.7f;
+	auto compacted = theNet.compact();
 	
-	if (argc > 3)
-		g_inputWords = std::atoi(argv[3]);
+	if (opt.projectWords != 0)
+	{
+		auto proj = theNet.projectMemoryUsage();
+		std::cout << "projected for " << proj.words << " words, " << proj.vocabulary << " distinct:\n";
+		proj.net.print(std::cout);
+		proj.text.print(std::cout);
+		return 0;
+	}
+	if (opt.printMemory)
+	{
+		compacted.print(std::cerr);
+		theNet.memoryUsage().print(std::cerr);
+		theNet.getText().memoryUsage().print(std::cerr);
+	}
 	
-	for (int i = 0; i < ((int)theNet.getText().seq.size() - g_inputWords - 1); ++i)
-		theNet.addWordPattern(i, learnMul);
+	if (opt.nodeOrder == "targets")
+		theNet.reorderLayer(1, theNet.orderByTargets(1));
+	else if (opt.nodeOrder == "sources")
+		theNet.reorderLayer(1, theNet.orderBySources(1));
 	
-	std::deque<int> textGen;
-	std::mt19937 rgen;
+	std::unique_ptr<SpoofGPT::Logic> logic;
+	if (opt.engine == "logic")
+	{
+		if (!SpoofGPT::Logic::isLogic(theNet))
+			throw std::runtime_error("the network isn't made of 0/1 logic");
+		logic = std::make_unique<SpoofGPT::Logic>(theNet);
+	}
 	
-	// 'launch' the generator
-	for (int i = 0; i < g_inputWords; ++i)
+	std::unique_ptr<SpoofShards> shards;
+	if (opt.shards > 1 && !logic)
 	{
-		int ind = theNet.getText().seq[i];
-		textGen.push_back(ind);
+		shards = std::make_unique<SpoofShards>(theNet, opt.shards);
+		if (opt.printMemory)
+		{
+			std::cerr << "sharded:\n";
+			shards->memoryUsage().print(std::cerr);
+		}
+		// the shards own their copies of the topology
+		theNet.mat = {};
 	}
 	
-	while (true)
+	const bool ingesting = !opt.ingestFile.empty() && !logic && !shards;
+	if (!opt.ingestFile.empty() && !ingesting)
+		std::cerr << "learning while generating needs the float engine without shards\n";
+	
+	// the served model, readers pin a version per step
+	Versioned<SpoofVersion> versions(1, std::make_unique<SpoofVersion>(std::move(theNetPtr)));
+	std::thread ingestThread;
+	if (ingesting)
+		ingestThread = std::thread([&] {
+			if (ingestFile(versions, opt.ingestFile.c_str(), opt.chunkBytes, opt.ingestChunks) != 0)
+				std::cerr << "failed to learn " << opt.ingestFile << '\n';
+		});
+	
+	std::deque<int> textGen;
+	std::mt19937 rgen, sampleRgen;
+	SpoofVersion::State act;
+	SpoofGPT::Logic::State bits;
+	if (logic)
+		bits = logic->makeState();
+	
+	// 'launch' the generator, the ingest thread may already replace the version
 	{
-		std::cout << theNet.getText().voc[textGen.back()] << ' ';
-		std::this_thread::sleep_for(std::chrono::milliseconds(300));
-		if (textGen.size() > g_inputWords)
+		auto model = versions.pin(0);
+		for (int i = 0; i < opt.order; ++i)
+		{
+			int ind = model->base->getText().seq[i];
+			textGen.push_back(ind);
+		}
+	}
+	
+	// returns false when the network had no better idea than repeating the word
+	const auto step = [&]() {
+		auto model = versions.pin(0);
+		
+		if (textGen.size() > model->getOrder())
 			textGen.pop_front();
-		theNet.loadInput(textGen);
-		theNet.run();
+		int word;
+		if (logic)
+		{
+			model->base->loadInput(*logic, bits, textGen);
+			logic->run(bits);
+			word = model->base->readOutput(*logic, bits, sampleRgen);
+		}
+		else if (shards)
+			word = shards->readOutput(textGen, sampleRgen);
+		else {
+			model->run(act, textGen);
+			word = model->readOutput(act, sampleRgen);
+		}
 		
-		int word = theNet.readOutput();
-		if (word != textGen.back())
+		if (word != textGen.back()) {
 			textGen.push_back(word);
-		else {
-			textGen.push_back(rgen() % theNet.getText().voc.size());
-			std::cout << '!';
+			return true;
+		}
+		textGen.push_back(rgen() % model->words());
+		return false;
+	};
+	
+	if (opt.benchSteps > 0)
+	{
+		auto beg = std::chrono::steady_clock::now();
+		for (int i = 0; i != opt.benchSteps; ++i)
+			step();
+		auto end = std::chrono::steady_clock::now();
+		
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - beg).count();
+		std::cerr << opt.engine << " engine, order " << opt.nodeOrder << ": " << ns / opt.benchSteps << " ns per step\n";
+		if (ingestThread.joinable())
+			ingestThread.join();
+		return 0;
+	}
+	
+	while (true)
+	{
+		{
+			auto model = versions.pin(0);
+			std::cout << model->word(textGen.back()) << ' ';
 		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(opt.pacing));
+		if (!step())
+			std::cout << '!';
 	}
 }
\ No newline at end of file